@@ -0,0 +1,23 @@
+#!/bin/bash
+#
+# Events per second of a release build that keeps all logging (LOGLEVEL_TRACE)
+# against the default release build, which strips everything below EV_INFO
+# (see src/makefrag). Both run the same configuration in express mode; the
+# default build is left in place.
+#
+#   ./benchmark_loglevel.sh [config] [sim-time-limit]
+#
+CONFIG=${1:-General}
+LIMIT=${2:-7d}
+DIR=$(cd $(dirname $0) && pwd)
+
+run() {
+  (cd $DIR/../src && make clean > /dev/null && make MODE=release FLORA_LOGLEVEL=$1 -j$(nproc) > /dev/null) || exit 1
+  start=$(date +%s.%N)
+  events=$(cd $DIR && ../src/run_flora -u Cmdenv -c $CONFIG --cmdenv-express-mode=true --sim-time-limit=$LIMIT --record-eventlog=false 2>&1 | sed -n 's/.*event #\([0-9]*\).*/\1/p' | tail -1)
+  end=$(date +%s.%N)
+  echo "$1: $events events in $(echo "$end - $start" | bc) s, $(echo "$events / ($end - $start)" | bc) ev/sec"
+}
+
+run LOGLEVEL_TRACE
+run LOGLEVEL_INFO
@@ -0,0 +1,200 @@
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+// 
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see http://www.gnu.org/licenses/.
+// 
+
+#include "LoRaBackhaul.h"
+#include "LoRaMacFrame_m.h"
+#include "inet/networklayer/common/L3AddressTag_m.h"
+#include "inet/networklayer/common/ModuleIdAddress.h"
+#include "inet/common/ModuleAccess.h"
+
+namespace flora {
+
+Define_Module(LoRaBackhaul);
+
+LoRaBackhaul::~LoRaBackhaul()
+{
+    for (auto& entry : links) {
+        cancelAndDelete(entry.second.outageTimer);
+        for (auto& buffered : entry.second.buffer)
+            delete buffered.first;
+    }
+}
+
+void LoRaBackhaul::initialize()
+{
+    bandwidth = bps(par("bandwidth"));
+    lossProbability = par("lossProbability");
+    bufferCapacity = par("bufferCapacity");
+    receiveWindowLength = par("receiveWindowLength");
+    classBScheduler = findModuleFromPar<LoRaClassBScheduler>(par("classBSchedulerModule"), this);
+    uplinkDelay.setName("uplinkDelay");
+    downlinkSlack.setName("downlinkSlack");
+}
+
+void LoRaBackhaul::handleMessage(cMessage *msg)
+{
+    if (msg->isPacket())
+        deliver(check_and_cast<Packet *>(msg));
+    else
+        handleOutageTimer(msg);
+}
+
+L3Address LoRaBackhaul::getAddress(const cModule *module)
+{
+    return L3Address(ModuleIdAddress(module->getId()));
+}
+
+LoRaBackhaul::Link& LoRaBackhaul::getLink(cModule *gateway)
+{
+    auto it = links.find(gateway->getId());
+    if (it != links.end())
+        return it->second;
+    Link& link = links[gateway->getId()];
+    link.gateway = gateway;
+    simtime_t timeToOutage = par("timeToOutage").doubleValue();
+    if (timeToOutage >= 0) {
+        link.outageTimer = new cMessage("outage");
+        link.outageTimer->setContextPointer(&link);
+        scheduleAt(simTime() + timeToOutage, link.outageTimer);
+    }
+    return link;
+}
+
+void LoRaBackhaul::sendUplink(cModule *gateway, Packet *packet, const L3Address& server)
+{
+    Enter_Method("sendUplink");
+    take(packet);
+    packet->setTimestamp();
+    Link& link = getLink(gateway);
+    cModule *destination = getSimulation()->getModule(server.toModuleId().getId());
+    if (destination == nullptr)
+        throw cRuntimeError("No network server with backhaul address %s", server.str().c_str());
+    packet->addTagIfAbsent<L3AddressInd>()->setSrcAddress(getAddress(gateway));
+    if (link.up)
+        transmit(link, packet, destination, true);
+    else if (bufferCapacity < 0 || (int)link.buffer.size() < bufferCapacity) {
+        // store and forward: the gateway keeps the uplink until the link is back
+        numUplinksBuffered++;
+        link.buffer.emplace_back(packet, destination);
+    }
+    else {
+        numUplinksBufferDropped++;
+        delete packet;
+    }
+}
+
+void LoRaBackhaul::sendDownlink(Packet *packet, const L3Address& gateway)
+{
+    Enter_Method("sendDownlink");
+    take(packet);
+    packet->setTimestamp();
+    cModule *destination = getSimulation()->getModule(gateway.toModuleId().getId());
+    if (destination == nullptr)
+        throw cRuntimeError("No gateway with backhaul address %s", gateway.str().c_str());
+    Link& link = getLink(destination);
+    // downlinks are bound to receive windows, storing them is pointless
+    if (!link.up) {
+        numDownlinksLostInOutage++;
+        delete packet;
+        return;
+    }
+    transmit(link, packet, destination, false);
+}
+
+void LoRaBackhaul::transmit(Link& link, Packet *packet, cModule *destination, bool uplink)
+{
+    simtime_t& busyUntil = uplink ? link.uplinkBusyUntil : link.downlinkBusyUntil;
+    simtime_t start = std::max(simTime(), busyUntil);
+    busyUntil = start + packet->getTotalLength().get() / bandwidth.get();
+    if (uniform(0, 1) < lossProbability) {
+        numLost++;
+        delete packet;
+        return;
+    }
+    packet->setContextPointer(destination);
+    packet->setKind(uplink);
+    scheduleAt(busyUntil + par("latency").doubleValue(), packet);
+}
+
+void LoRaBackhaul::deliver(Packet *packet)
+{
+    auto destination = static_cast<cModule *>(packet->getContextPointer());
+    packet->setContextPointer(nullptr);
+    if (packet->getKind()) {
+        numUplinksForwarded++;
+        uplinkDelay.collect(simTime() - packet->getTimestamp());
+    }
+    else {
+        numDownlinksForwarded++;
+        const auto& frame = packet->peekAtFront<LoRaMacFrame>();
+        simtime_t txTime = frame->getTxTime();
+        if (txTime >= 0) {
+            // the gateway still starts a downlink arriving after RX1 opened,
+            // up to the end of RX2 (or of the ping slot)
+            simtime_t latestStart;
+            if (frame->getPingSlot()) {
+                if (classBScheduler == nullptr)
+                    throw cRuntimeError("Ping-slot downlink, but no LoRaClassBScheduler");
+                latestStart = txTime + classBScheduler->getPingSlotLength();
+            }
+            else
+                latestStart = std::max(txTime, frame->getRx2Time()) + receiveWindowLength;
+            downlinkSlack.collect(latestStart - simTime());
+            if (simTime() > txTime)
+                numDownlinksAfterRx1Start++;
+            if (simTime() >= latestStart)
+                numDownlinksTooLate++;
+        }
+    }
+    sendDirect(packet, destination, "backhaulIn");
+}
+
+void LoRaBackhaul::handleOutageTimer(cMessage *timer)
+{
+    Link& link = *static_cast<Link *>(timer->getContextPointer());
+    if (link.up) {
+        EV_DETAIL << "backhaul of " << link.gateway->getFullPath() << " goes down" << endl;
+        link.up = false;
+        numOutages++;
+        scheduleAt(simTime() + par("outageDuration").doubleValue(), timer);
+    }
+    else {
+        EV_DETAIL << "backhaul of " << link.gateway->getFullPath() << " is back, flushing " << link.buffer.size() << " uplinks" << endl;
+        link.up = true;
+        while (!link.buffer.empty()) {
+            auto buffered = link.buffer.front();
+            link.buffer.pop_front();
+            transmit(link, buffered.first, buffered.second, true);
+        }
+        scheduleAt(simTime() + par("timeToOutage").doubleValue(), timer);
+    }
+}
+
+void LoRaBackhaul::finish()
+{
+    recordScalar("numUplinksForwarded", numUplinksForwarded);
+    recordScalar("numUplinksBuffered", numUplinksBuffered);
+    recordScalar("numUplinksBufferDropped", numUplinksBufferDropped);
+    recordScalar("numLost", numLost);
+    recordScalar("numOutages", numOutages);
+    recordScalar("numDownlinksForwarded", numDownlinksForwarded);
+    recordScalar("numDownlinksLostInOutage", numDownlinksLostInOutage);
+    recordScalar("numDownlinksAfterRx1Start", numDownlinksAfterRx1Start);
+    recordScalar("numDownlinksTooLate", numDownlinksTooLate);
+    uplinkDelay.recordAs("uplinkDelay", "s");
+    downlinkSlack.recordAs("downlinkSlack", "s");
+}
+
+} // namespace flora
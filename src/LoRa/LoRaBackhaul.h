@@ -0,0 +1,98 @@
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+// 
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see http://www.gnu.org/licenses/.
+// 
+
+#ifndef LORA_LORABACKHAUL_H_
+#define LORA_LORABACKHAUL_H_
+
+#include <deque>
+#include <map>
+
+#include "inet/common/INETDefs.h"
+#include "inet/common/packet/Packet.h"
+#include "inet/networklayer/common/L3Address.h"
+#include "LoRaClassBScheduler.h"
+
+namespace flora {
+
+using namespace inet;
+
+/**
+ * Lightweight backhaul between the packet forwarders of the gateways and
+ * the network servers. See LoRaBackhaul.ned.
+ */
+class LoRaBackhaul : public cSimpleModule
+{
+  protected:
+    /** State of the link of one gateway */
+    struct Link
+    {
+        cModule *gateway = nullptr;
+        bool up = true;
+        /** Serialization of the previous packet ends at these times */
+        simtime_t uplinkBusyUntil = 0;
+        simtime_t downlinkBusyUntil = 0;
+        /** Uplinks stored at the gateway while the link is down, with their destination */
+        std::deque<std::pair<Packet *, cModule *>> buffer;
+        cMessage *outageTimer = nullptr;
+    };
+
+    bps bandwidth = bps(NaN);
+    double lossProbability = NaN;
+    int bufferCapacity = -1;
+    /** Receive window length of the gateways, see LoRaGWMac */
+    simtime_t receiveWindowLength;
+    /** Gives the ping slot length, if any */
+    LoRaClassBScheduler *classBScheduler = nullptr;
+
+    /** Links keyed by the module id of the packet forwarder */
+    std::map<int, Link> links;
+
+    long numUplinksForwarded = 0;
+    long numUplinksBuffered = 0;
+    long numUplinksBufferDropped = 0;
+    long numLost = 0;
+    long numOutages = 0;
+    long numDownlinksForwarded = 0;
+    long numDownlinksLostInOutage = 0;
+    long numDownlinksAfterRx1Start = 0;
+    long numDownlinksTooLate = 0;
+    cStdDev uplinkDelay;
+    cStdDev downlinkSlack;
+
+  protected:
+    virtual void initialize() override;
+    virtual void handleMessage(cMessage *msg) override;
+    virtual void finish() override;
+
+    virtual Link& getLink(cModule *gateway);
+    virtual void transmit(Link& link, Packet *packet, cModule *destination, bool uplink);
+    virtual void deliver(Packet *packet);
+    virtual void handleOutageTimer(cMessage *timer);
+
+  public:
+    virtual ~LoRaBackhaul();
+
+    /** Forwards an uplink from the gateway to the network server addressed by its module id */
+    virtual void sendUplink(cModule *gateway, Packet *packet, const L3Address& server);
+    /** Forwards a downlink from a network server to the gateway addressed by its module id */
+    virtual void sendDownlink(Packet *packet, const L3Address& gateway);
+
+    /** Backhaul address of a module, e.g. of a packet forwarder or a network server application */
+    static L3Address getAddress(const cModule *module);
+};
+
+} // namespace flora
+
+#endif /* LORA_LORABACKHAUL_H_ */
@@ -0,0 +1,150 @@
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+// 
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see http://www.gnu.org/licenses/.
+// 
+
+#include "LoRaClassBScheduler.h"
+#include "LoRaMac.h"
+#include "LoRaServerRing.h"
+
+namespace flora {
+
+Define_Module(LoRaClassBScheduler);
+
+LoRaClassBScheduler::~LoRaClassBScheduler()
+{
+    cancelAndDelete(beaconPeriodTimer);
+    cancelAndDelete(wakeupTimer);
+}
+
+void LoRaClassBScheduler::initialize()
+{
+    beaconPeriod = par("beaconPeriod");
+    beaconReserved = par("beaconReserved");
+    beaconWindow = par("beaconWindow");
+    pingSlotLength = par("pingSlotLength");
+    wakeupGuard = par("wakeupGuard");
+    beaconCF = Hz(par("beaconCF").doubleValue());
+    beaconSF = par("beaconSF");
+    beaconBW = Hz(par("beaconBW").doubleValue());
+    if (beaconReserved + numPingSlots * pingSlotLength > beaconPeriod)
+        throw cRuntimeError("%d ping slots of %s do not fit into the beacon period", numPingSlots, pingSlotLength.str().c_str());
+
+    beaconPeriodTimer = new cMessage("beaconPeriod");
+    wakeupTimer = new cMessage("wakeup");
+    // the wake-ups of a period are planned when the first of them, the beacon window, opens
+    scheduleAt(beaconPeriod - wakeupGuard, beaconPeriodTimer);
+    WATCH(numWakeupEvents);
+    WATCH(numWakeups);
+}
+
+void LoRaClassBScheduler::registerNode(LoRaMac *mac)
+{
+    Enter_Method_Silent();
+    nodes.push_back(mac);
+    nodesByAddress[mac->getAddress()] = mac;
+}
+
+int LoRaClassBScheduler::registerBeaconingGateway()
+{
+    Enter_Method_Silent();
+    return numBeaconingGateways++;
+}
+
+simtime_t LoRaClassBScheduler::getNextPingSlot(const MacAddress& address, simtime_t earliest)
+{
+    Enter_Method_Silent();
+    auto it = nodesByAddress.find(address);
+    if (it == nodesByAddress.end())
+        return -1;
+    int pingNb = 1 << (7 - it->second->getPingSlotPeriodicity());
+    int pingPeriod = numPingSlots / pingNb;
+    // the first beacon is sent one beacon period after the start
+    for (int64_t beaconIndex = std::max((int64_t)1, (int64_t)(earliest / beaconPeriod)); ; beaconIndex++) {
+        simtime_t beaconTime = beaconPeriod * beaconIndex;
+        int pingOffset = computePingOffset(beaconIndex, address, pingPeriod);
+        for (int i = 0; i < pingNb; i++) {
+            simtime_t slotStart = beaconTime + beaconReserved + (pingOffset + i * pingPeriod) * pingSlotLength;
+            if (slotStart >= earliest)
+                return slotStart;
+        }
+    }
+}
+
+int LoRaClassBScheduler::computePingOffset(int64_t beaconIndex, const MacAddress& address, int pingPeriod)
+{
+    // a cheap stand-in for the AES encryption of the specification
+    uint64_t x = LoRaServerRing::hash(((uint64_t)beaconIndex << 48) ^ address.getInt());
+    return (int)(x % pingPeriod);
+}
+
+void LoRaClassBScheduler::scheduleBeaconPeriod(simtime_t beaconTime)
+{
+    int64_t beaconIndex = (int64_t)(beaconTime / beaconPeriod);
+    for (auto mac : nodes) {
+        addWakeup(beaconTime - wakeupGuard, mac, true, true);
+        addWakeup(beaconTime + beaconWindow, mac, false, true);
+        // ping slots are only served while the node is synchronized to the beacons
+        if (!mac->isBeaconLocked())
+            continue;
+        int pingNb = 1 << (7 - mac->getPingSlotPeriodicity());
+        int pingPeriod = numPingSlots / pingNb;
+        int pingOffset = computePingOffset(beaconIndex, mac->getAddress(), pingPeriod);
+        for (int i = 0; i < pingNb; i++) {
+            simtime_t slotStart = beaconTime + beaconReserved + (pingOffset + i * pingPeriod) * pingSlotLength;
+            addWakeup(slotStart - wakeupGuard, mac, true, false);
+            addWakeup(slotStart + pingSlotLength, mac, false, false);
+        }
+    }
+    if (!wakeups.empty()) {
+        cancelEvent(wakeupTimer);
+        scheduleAt(wakeups.begin()->first, wakeupTimer);
+    }
+}
+
+void LoRaClassBScheduler::deliverWakeups()
+{
+    auto it = wakeups.begin();
+    numWakeupEvents++;
+    for (auto& wakeup : it->second) {
+        wakeup.mac->handleClassBWakeup(wakeup.open, wakeup.beaconWindow);
+        numWakeups++;
+    }
+    wakeups.erase(it);
+    if (!wakeups.empty())
+        scheduleAt(wakeups.begin()->first, wakeupTimer);
+}
+
+void LoRaClassBScheduler::handleMessage(cMessage *msg)
+{
+    if (msg == beaconPeriodTimer) {
+        simtime_t beaconTime = simTime() + wakeupGuard;
+        scheduleBeaconPeriod(beaconTime);
+        scheduleAt(beaconTime + beaconPeriod - wakeupGuard, beaconPeriodTimer);
+    }
+    else if (msg == wakeupTimer)
+        deliverWakeups();
+    else
+        throw cRuntimeError("Unknown message '%s'", msg->getName());
+}
+
+void LoRaClassBScheduler::finish()
+{
+    recordScalar("numClassBNodes", nodes.size());
+    recordScalar("numWakeupEvents", numWakeupEvents);
+    recordScalar("numWakeups", numWakeups);
+    if (numWakeupEvents > 0)
+        recordScalar("wakeupsPerEvent", (double)numWakeups / numWakeupEvents);
+}
+
+} // namespace flora
@@ -0,0 +1,105 @@
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+// 
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see http://www.gnu.org/licenses/.
+// 
+
+#ifndef LORA_LORACLASSBSCHEDULER_H_
+#define LORA_LORACLASSBSCHEDULER_H_
+
+#include <algorithm>
+#include <map>
+#include <vector>
+
+#include "inet/common/INETDefs.h"
+#include "inet/common/Units.h"
+#include "inet/linklayer/common/MacAddress.h"
+
+namespace flora {
+
+using namespace inet;
+
+class LoRaMac;
+
+/**
+ * Shared beacon and ping-slot wake-up timer of all Class B end nodes.
+ * See LoRaClassBScheduler.ned.
+ */
+class LoRaClassBScheduler : public cSimpleModule
+{
+  protected:
+    struct Wakeup {
+        LoRaMac *mac;
+        bool open;
+        bool beaconWindow;
+    };
+
+    static const int numPingSlots = 4096;
+
+    simtime_t beaconPeriod;
+    simtime_t beaconReserved;
+    simtime_t beaconWindow;
+    simtime_t pingSlotLength;
+    simtime_t wakeupGuard;
+    Hz beaconCF = Hz(NaN);
+    int beaconSF = -1;
+    Hz beaconBW = Hz(NaN);
+    int numBeaconingGateways = 0;
+
+    std::vector<LoRaMac *> nodes;
+    std::map<MacAddress, LoRaMac *> nodesByAddress;
+    /** Pending wake-ups of the current beacon period, grouped by time */
+    std::map<simtime_t, std::vector<Wakeup>> wakeups;
+
+    cMessage *beaconPeriodTimer = nullptr;
+    cMessage *wakeupTimer = nullptr;
+
+    long numWakeupEvents = 0;
+    long numWakeups = 0;
+
+  protected:
+    virtual void initialize() override;
+    virtual void handleMessage(cMessage *msg) override;
+    virtual void finish() override;
+
+    virtual void scheduleBeaconPeriod(simtime_t beaconTime);
+    virtual void deliverWakeups();
+    void addWakeup(simtime_t time, LoRaMac *mac, bool open, bool beaconWindow) { wakeups[time].push_back({mac, open, beaconWindow}); }
+
+  public:
+    virtual ~LoRaClassBScheduler();
+
+    virtual void registerNode(LoRaMac *mac);
+    /** Returns the turn of the gateway among the beaconing gateways, see numBeaconingGateways */
+    virtual int registerBeaconingGateway();
+
+    simtime_t getBeaconPeriod() const { return beaconPeriod; }
+    simtime_t getPingSlotLength() const { return pingSlotLength; }
+    Hz getBeaconCF() const { return beaconCF; }
+    int getBeaconSF() const { return beaconSF; }
+    Hz getBeaconBW() const { return beaconBW; }
+    int getNumBeaconingGateways() const { return numBeaconingGateways; }
+
+    /**
+     * Start of the first ping slot of the node at or after earliest, as the
+     * network server computes it to schedule a Class B downlink; -1 if the
+     * node is not a registered Class B node.
+     */
+    virtual simtime_t getNextPingSlot(const MacAddress& address, simtime_t earliest);
+
+    /** Slot index of the node within a ping period of pingPeriod slots, like the LoRaWAN AES based offset */
+    static int computePingOffset(int64_t beaconIndex, const MacAddress& address, int pingPeriod);
+};
+
+} // namespace flora
+
+#endif /* LORA_LORACLASSBSCHEDULER_H_ */
@@ -0,0 +1,88 @@
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+// 
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see http://www.gnu.org/licenses/.
+// 
+
+#ifndef LORA_LORAFRAMEEVENT_H_
+#define LORA_LORAFRAMEEVENT_H_
+
+#include "inet/common/INETDefs.h"
+#include "inet/linklayer/common/MacAddress.h"
+
+namespace flora {
+
+using namespace inet;
+
+/**
+ * Frame level event emitted on the loRaFrameEvent signal. Modules only fill
+ * it in when the signal has listeners, i.e. when a LoRaFrameTrace is present.
+ */
+class LoRaFrameEvent : public cObject
+{
+  public:
+    enum Type : uint8_t {
+        UPLINK_TX = 1,
+        GW_RX = 2,
+        NS_RX = 3,
+        DOWNLINK_TX = 4,
+        GW_FORWARDED = 5
+    };
+
+    enum Outcome : uint8_t {
+        OUTCOME_NONE = 0,
+        RX_OK = 1,
+        RX_COLLISION = 2,
+        RX_BELOW_SENSITIVITY = 3,
+        RX_HALF_DUPLEX = 4,
+        RX_IGNORED = 5,
+        NS_FIRST_COPY = 6,
+        NS_DUPLICATE = 7,
+        DL_SENT = 8,
+        DL_DROPPED_DUTY_CYCLE = 9,
+        DL_RESLOTTED = 10,
+        DL_REJECTED_TOO_LATE = 11,
+        DL_REJECTED_CONFLICT = 12,
+        DL_REJECTED_QUEUE_FULL = 13
+    };
+
+    enum Flags : uint8_t {
+        FLAG_CONFIRMED = 1,
+        FLAG_JOIN_REQUEST = 2,
+        FLAG_ADR_ACK_REQ = 4
+    };
+
+    static simsignal_t loRaFrameEventSignal;
+
+    Type type = UPLINK_TX;
+    Outcome outcome = OUTCOME_NONE;
+    /** Address of the end node the frame belongs to */
+    MacAddress nodeAddress;
+    int sequenceNumber = -1;
+    int spreadFactor = 0;
+    /**
+     * Received power in dBm (transmission power for UPLINK_TX and DOWNLINK_TX)
+     * and SNIR in dB, NaN if not applicable
+     */
+    double power = NaN;
+    double snir = NaN;
+    /** Transmission power of the end node in dBm, NaN if not applicable */
+    double txPower = NaN;
+    uint8_t flags = 0;
+
+  public:
+    LoRaFrameEvent(Type type, Outcome outcome) : type(type), outcome(outcome) {}
+};
+
+} // namespace flora
+
+#endif /* LORA_LORAFRAMEEVENT_H_ */
@@ -0,0 +1,106 @@
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+// 
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see http://www.gnu.org/licenses/.
+// 
+
+#include "LoRaFrameTrace.h"
+#include "inet/common/INETUtils.h"
+
+namespace flora {
+
+Define_Module(LoRaFrameTrace);
+
+LoRaFrameTrace::~LoRaFrameTrace()
+{
+    if (trace.is_open())
+        trace.close();
+}
+
+void LoRaFrameTrace::initialize()
+{
+    if (!par("enabled"))
+        return;
+    moduleMatcher.setPattern(par("moduleFilter"), true, true, true);
+    startTime = par("startTime");
+    endTime = par("endTime");
+    const char *fileName = par("traceFile");
+    inet::utils::makePathForFile(fileName);
+    trace.open(fileName, std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!trace.is_open())
+        throw cRuntimeError("Cannot open frame trace file '%s'", fileName);
+    trace.write("LFTR", 4);
+    writeValue<uint16_t>(traceVersion);
+    writeValue<uint16_t>(recordSize);
+    getSimulation()->getSystemModule()->subscribe(LoRaFrameEvent::loRaFrameEventSignal, this);
+    WATCH(numRecords);
+}
+
+void LoRaFrameTrace::handleMessage(cMessage *msg)
+{
+    throw cRuntimeError("This module does not handle messages");
+}
+
+void LoRaFrameTrace::finish()
+{
+    if (!trace.is_open())
+        return;
+    trace.write("LFTM", 4);
+    writeValue<uint32_t>(tracedModules.size());
+    for (auto& it : tracedModules) {
+        writeValue<int32_t>(it.first);
+        writeValue<uint16_t>(it.second.size());
+        trace.write(it.second.c_str(), it.second.size());
+    }
+    trace.close();
+    recordScalar("frameTraceRecords", numRecords);
+}
+
+bool LoRaFrameTrace::matchesModule(cComponent *source)
+{
+    auto it = moduleMatches.find(source->getId());
+    if (it != moduleMatches.end())
+        return it->second;
+    bool matches = moduleMatcher.matches(source->getFullPath().c_str());
+    moduleMatches[source->getId()] = matches;
+    return matches;
+}
+
+void LoRaFrameTrace::receiveSignal(cComponent *source, simsignal_t signal, cObject *obj, cObject *details)
+{
+    simtime_t now = simTime();
+    if (now < startTime || (endTime >= 0 && now > endTime))
+        return;
+    if (!matchesModule(source))
+        return;
+    writeRecord(source, check_and_cast<const LoRaFrameEvent *>(obj));
+}
+
+void LoRaFrameTrace::writeRecord(cComponent *source, const LoRaFrameEvent *event)
+{
+    if (tracedModules.find(source->getId()) == tracedModules.end())
+        tracedModules[source->getId()] = source->getFullPath();
+    writeValue<double>(simTime().dbl());
+    writeValue<uint8_t>(event->type);
+    writeValue<uint8_t>(event->outcome);
+    writeValue<int8_t>(event->spreadFactor);
+    writeValue<uint8_t>(event->flags);
+    writeValue<int32_t>(source->getId());
+    writeValue<uint64_t>(event->nodeAddress.getInt());
+    writeValue<int32_t>(event->sequenceNumber);
+    writeValue<float>(event->power);
+    writeValue<float>(event->snir);
+    writeValue<float>(event->txPower);
+    numRecords++;
+}
+
+} // namespace flora
@@ -0,0 +1,68 @@
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+// 
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see http://www.gnu.org/licenses/.
+// 
+
+#ifndef LORA_LORAFRAMETRACE_H_
+#define LORA_LORAFRAMETRACE_H_
+
+#include <fstream>
+#include <map>
+#include <unordered_map>
+
+#include "inet/common/INETDefs.h"
+#include "LoRaFrameEvent.h"
+
+namespace flora {
+
+using namespace inet;
+
+/**
+ * Writes LoRaFrameEvent signals of the whole network into a binary trace.
+ * See LoRaFrameTrace.ned for the file layout.
+ */
+class LoRaFrameTrace : public cSimpleModule, public cListener
+{
+  protected:
+    static const uint16_t traceVersion = 2;
+    static const uint16_t recordSize = 40;
+
+    std::ofstream trace;
+    cPatternMatcher moduleMatcher;
+    simtime_t startTime;
+    simtime_t endTime;
+    /** Filter decision per emitting module id, the pattern is matched once per module */
+    std::unordered_map<int, bool> moduleMatches;
+    /** Modules that actually appear in the trace, written to the module table */
+    std::map<int, std::string> tracedModules;
+    long numRecords = 0;
+
+  protected:
+    virtual void initialize() override;
+    virtual void handleMessage(cMessage *msg) override;
+    virtual void finish() override;
+
+    virtual bool matchesModule(cComponent *source);
+    virtual void writeRecord(cComponent *source, const LoRaFrameEvent *event);
+
+    template<typename T>
+    void writeValue(T value) { trace.write(reinterpret_cast<const char *>(&value), sizeof(T)); }
+
+  public:
+    virtual ~LoRaFrameTrace();
+    virtual void receiveSignal(cComponent *source, simsignal_t signal, cObject *obj, cObject *details) override;
+};
+
+} // namespace flora
+
+#endif /* LORA_LORAFRAMETRACE_H_ */
@@ -26,6 +26,9 @@ namespace flora {
 
 Define_Module(LoRaGWMac);
 
+simsignal_t LoRaGWMac::jitQueueLengthSignal = cComponent::registerSignal("jitQueueLength");
+simsignal_t LoRaGWMac::downlinkRejectedSignal = cComponent::registerSignal("LoRa_DownlinkRejected");
+
 void LoRaGWMac::initialize(int stage)
 {
     MacProtocolBase::initialize(stage);
@@ -35,8 +38,9 @@ void LoRaGWMac::initialize(int stage)
         //radioModule->subscribe(IRadio::radioModeChangedSignal, this);
         radioModule->subscribe(IRadio::transmissionStateChangedSignal, this);
         radio = check_and_cast<IRadio *>(radioModule);
-        waitingForDC = false;
-        dutyCycleTimer = new cMessage("Duty Cycle Timer");
+        jitTimer = new cMessage("JIT Timer");
+        receiveWindowLength = par("receiveWindowLength");
+        maxQueueSize = par("maxQueueSize");
         const char *addressString = par("address");
         GW_forwardedDown = 0;
         GW_droppedDC = 0;
@@ -48,9 +52,24 @@ void LoRaGWMac::initialize(int stage)
         }
         else
             address.setAddress(addressString);
+        classBScheduler = findModuleFromPar<LoRaClassBScheduler>(par("classBSchedulerModule"), this);
+        if (par("sendBeacons")) {
+            if (classBScheduler == nullptr)
+                throw cRuntimeError("sendBeacons requires a LoRaClassBScheduler");
+            beaconTurn = classBScheduler->registerBeaconingGateway();
+            beaconTimer = new cMessage("Beacon Timer");
+        }
     }
     else if (stage == INITSTAGE_LINK_LAYER) {
         radio->setRadioMode(IRadio::RADIO_MODE_TRANSCEIVER);
+        if (classBScheduler != nullptr)
+            pingSlotLength = classBScheduler->getPingSlotLength();
+        // all beaconing gateways registered in the previous stage
+        if (beaconTimer != nullptr) {
+            simtime_t beaconPeriod = classBScheduler->getBeaconPeriod();
+            beaconInterval = beaconPeriod * classBScheduler->getNumBeaconingGateways();
+            scheduleAt(beaconPeriod * (beaconTurn + 1), beaconTimer);
+        }
     }
 }
 
@@ -58,7 +77,21 @@ void LoRaGWMac::finish()
 {
     recordScalar("GW_forwardedDown", GW_forwardedDown);
     recordScalar("GW_droppedDC", GW_droppedDC);
-    cancelAndDelete(dutyCycleTimer);
+    recordScalar("numDownlinksReslotted", numDownlinksReslotted);
+    recordScalar("numRejectedTooLate", numRejectedTooLate);
+    recordScalar("numRejectedConflict", numRejectedConflict);
+    recordScalar("numRejectedQueueFull", numRejectedQueueFull);
+    for (auto& entry : jitQueue)
+        delete entry.second.packet;
+    jitQueue.clear();
+    cancelAndDelete(jitTimer);
+    jitTimer = nullptr;
+    if (beaconTimer) {
+        recordScalar("numBeaconsSent", numBeaconsSent);
+        recordScalar("numBeaconsSkipped", numBeaconsSkipped);
+        cancelAndDelete(beaconTimer);
+        beaconTimer = nullptr;
+    }
 }
 
 
@@ -94,47 +127,168 @@ void LoRaGWMac::configureNetworkInterface()
 
 void LoRaGWMac::handleSelfMessage(cMessage *msg)
 {
-    if(msg == dutyCycleTimer) waitingForDC = false;
+    if(msg == jitTimer) sendScheduledDownlink();
+    else if (msg == beaconTimer) {
+        sendBeacon();
+        scheduleAt(simTime() + beaconInterval, beaconTimer);
+    }
+}
+
+void LoRaGWMac::sendBeacon()
+{
+    // a downlink still on the air takes the beacon slot
+    if (transmissionState == IRadio::TRANSMISSION_STATE_TRANSMITTING) {
+        numBeaconsSkipped++;
+        return;
+    }
+    auto beacon = makeShared<LoRaMacFrame>();
+    beacon->setChunkLength(B(par("beaconLength").intValue()));
+    beacon->setBeacon(true);
+    beacon->setTransmitterAddress(address);
+    beacon->setReceiverAddress(MacAddress::BROADCAST_ADDRESS);
+    beacon->setLoRaTP(math::dBmW2mW(par("beaconTP").doubleValue()));
+    beacon->setLoRaCF(classBScheduler->getBeaconCF());
+    beacon->setLoRaSF(classBScheduler->getBeaconSF());
+    beacon->setLoRaBW(classBScheduler->getBeaconBW());
+    beacon->setLoRaCR(1);
+    beacon->setLoRaUseHeader(false);
+
+    auto pkt = new Packet("Beacon");
+    pkt->insertAtFront(beacon);
+    pkt->addTagIfAbsent<MacAddressReq>()->setDestAddress(MacAddress::BROADCAST_ADDRESS);
+    pkt->addTagIfAbsent<PacketProtocolTag>()->setProtocol(&Protocol::apskPhy);
+    numBeaconsSent++;
+    sendDown(pkt);
 }
 
 void LoRaGWMac::handleUpperMessage(cMessage *msg)
 {
-    if(waitingForDC == false)
-    {
-//        LoRaMacFrame *frame = check_and_cast<LoRaMacFrame *>(msg);
-//        frame->removeControlInfo();
-        auto pkt = check_and_cast<Packet *>(msg);
-        const auto &frame = pkt->peekAtFront<LoRaMacFrame>();
-        if (pkt->getControlInfo())
-            delete pkt->removeControlInfo();
-
-        auto tag = pkt->addTagIfAbsent<MacAddressReq>();
-        tag->setDestAddress(frame->getReceiverAddress());
-//        LoRaMacControlInfo *ctrl = new LoRaMacControlInfo();
-//        ctrl->setSrc(address);
-//        ctrl->setDest(frame->getReceiverAddress());
-//        frame->setControlInfo(ctrl);
-//        sendDown(frame);
-
-
-        waitingForDC = true;
-        double delta;
-        if(frame->getLoRaSF() == 7) delta = 0.61696;
-        if(frame->getLoRaSF() == 8) delta = 1.23392;
-        if(frame->getLoRaSF() == 9) delta = 2.14016;
-        if(frame->getLoRaSF() == 10) delta = 4.28032;
-        if(frame->getLoRaSF() == 11) delta = 7.24992;
-        if(frame->getLoRaSF() == 12) delta = 14.49984;
-        scheduleAt(simTime() + delta, dutyCycleTimer);
-        GW_forwardedDown++;
-        pkt->addTagIfAbsent<PacketProtocolTag>()->setProtocol(&Protocol::apskPhy);
-        sendDown(pkt);
+    auto pkt = check_and_cast<Packet *>(msg);
+    const auto &frame = pkt->peekAtFront<LoRaMacFrame>();
+    if (pkt->getControlInfo())
+        delete pkt->removeControlInfo();
+    if (maxQueueSize >= 0 && (int)jitQueue.size() >= maxQueueSize) {
+        rejectDownlink(pkt, LoRaFrameEvent::DL_REJECTED_QUEUE_FULL);
+        return;
     }
-    else
-    {
-        GW_droppedDC++;
-        delete msg;
+
+    simtime_t windowStart = frame->getTxTime() >= 0 ? frame->getTxTime() : simTime();
+    simtime_t span = getDutyCycleOffTime(frame->getLoRaSF());
+    simtime_t start;
+    simtime_t latest;
+    bool reslotted = false;
+    if (frame->getPingSlot()) {
+        if (classBScheduler == nullptr)
+            throw cRuntimeError("Ping-slot downlink, but no LoRaClassBScheduler");
+        // the Class B node only listens in this ping slot
+        latest = windowStart + pingSlotLength;
+        start = findDownlinkSlot(windowStart, latest, span);
+    }
+    else {
+        // RX1 first; RX2, as the network server timed it, if RX1 is over or taken
+        latest = windowStart + receiveWindowLength;
+        start = findDownlinkSlot(windowStart, latest, span);
+        if (start < 0 && frame->getRx2Time() >= 0) {
+            latest = frame->getRx2Time() + receiveWindowLength;
+            start = findDownlinkSlot(frame->getRx2Time(), latest, span);
+            reslotted = true;
+        }
+    }
+    if (start < 0) {
+        if (simTime() >= latest)
+            rejectDownlink(pkt, LoRaFrameEvent::DL_REJECTED_TOO_LATE);
+        else if (dutyCycleEndTime >= latest)
+            rejectDownlink(pkt, LoRaFrameEvent::DL_DROPPED_DUTY_CYCLE);
+        else
+            rejectDownlink(pkt, LoRaFrameEvent::DL_REJECTED_CONFLICT);
+        return;
     }
+    if (reslotted) {
+        numDownlinksReslotted++;
+        emitFrameEvent(frame, LoRaFrameEvent::DL_RESLOTTED);
+    }
+
+    pkt->addTagIfAbsent<MacAddressReq>()->setDestAddress(frame->getReceiverAddress());
+    pkt->addTagIfAbsent<PacketProtocolTag>()->setProtocol(&Protocol::apskPhy);
+    EV_DETAIL << "downlink to " << frame->getReceiverAddress() << " scheduled at " << start << endl;
+    jitQueue.emplace(start, ScheduledDownlink{pkt, start + span});
+    emit(jitQueueLengthSignal, (intval_t)jitQueue.size());
+    if (jitTimer->isScheduled())
+        cancelEvent(jitTimer);
+    scheduleAt(jitQueue.begin()->first, jitTimer);
+}
+
+simtime_t LoRaGWMac::getDutyCycleOffTime(int spreadFactor)
+{
+    double delta = 0;
+    if(spreadFactor == 7) delta = 0.61696;
+    if(spreadFactor == 8) delta = 1.23392;
+    if(spreadFactor == 9) delta = 2.14016;
+    if(spreadFactor == 10) delta = 4.28032;
+    if(spreadFactor == 11) delta = 7.24992;
+    if(spreadFactor == 12) delta = 14.49984;
+    return delta;
+}
+
+simtime_t LoRaGWMac::findDownlinkSlot(simtime_t earliest, simtime_t latest, simtime_t span)
+{
+    // first fit: walk the queue in start time order, skipping past each
+    // downlink whose busy period the new one would overlap
+    simtime_t start = std::max(std::max(earliest, simTime()), dutyCycleEndTime);
+    for (const auto& entry : jitQueue) {
+        if (start + span <= entry.first)
+            break;
+        start = std::max(start, entry.second.busyUntil);
+    }
+    return start < latest ? start : -1;
+}
+
+void LoRaGWMac::sendScheduledDownlink()
+{
+    auto it = jitQueue.begin();
+    Packet *pkt = it->second.packet;
+    simtime_t busyUntil = it->second.busyUntil;
+    jitQueue.erase(it);
+    emit(jitQueueLengthSignal, (intval_t)jitQueue.size());
+    if (!jitQueue.empty())
+        scheduleAt(jitQueue.begin()->first, jitTimer);
+
+    // only a beacon can still be on the air here
+    if (transmissionState == IRadio::TRANSMISSION_STATE_TRANSMITTING) {
+        rejectDownlink(pkt, LoRaFrameEvent::DL_REJECTED_CONFLICT);
+        return;
+    }
+    dutyCycleEndTime = busyUntil;
+    GW_forwardedDown++;
+    emitFrameEvent(pkt->peekAtFront<LoRaMacFrame>(), LoRaFrameEvent::DL_SENT);
+    sendDown(pkt);
+}
+
+void LoRaGWMac::rejectDownlink(Packet *pkt, LoRaFrameEvent::Outcome reason)
+{
+    EV_DETAIL << "rejecting downlink " << pkt->getName() << ", reason " << (int)reason << endl;
+    switch (reason) {
+        case LoRaFrameEvent::DL_DROPPED_DUTY_CYCLE: GW_droppedDC++; break;
+        case LoRaFrameEvent::DL_REJECTED_TOO_LATE: numRejectedTooLate++; break;
+        case LoRaFrameEvent::DL_REJECTED_QUEUE_FULL: numRejectedQueueFull++; break;
+        default: numRejectedConflict++; break;
+    }
+    emitFrameEvent(pkt->peekAtFront<LoRaMacFrame>(), reason);
+    // back-pressure towards the network server
+    emit(downlinkRejectedSignal, (intval_t)reason, pkt);
+    delete pkt;
+}
+
+void LoRaGWMac::emitFrameEvent(const Ptr<const LoRaMacFrame>& frame, LoRaFrameEvent::Outcome outcome)
+{
+    if (!mayHaveListeners(LoRaFrameEvent::loRaFrameEventSignal))
+        return;
+    LoRaFrameEvent event(LoRaFrameEvent::DOWNLINK_TX, outcome);
+    event.nodeAddress = frame->getReceiverAddress();
+    event.sequenceNumber = frame->getSequenceNumber();
+    event.spreadFactor = frame->getLoRaSF();
+    event.power = math::mW2dBmW(frame->getLoRaTP());
+    emit(LoRaFrameEvent::loRaFrameEventSignal, &event);
 }
 
 void LoRaGWMac::handleLowerMessage(cMessage *msg)
@@ -142,7 +296,8 @@ void LoRaGWMac::handleLowerMessage(cMessage *msg)
     auto pkt = check_and_cast<Packet *>(msg);
     auto header = pkt->popAtFront<LoRaPhyPreamble>();
     const auto &frame = pkt->peekAtFront<LoRaMacFrame>();
-    if(frame->getReceiverAddress() == MacAddress::BROADCAST_ADDRESS)
+    // beacons of neighbouring gateways are not forwarded
+    if(frame->getReceiverAddress() == MacAddress::BROADCAST_ADDRESS && !frame->getBeacon())
         sendUp(pkt);
     else
         delete pkt;
@@ -151,7 +306,7 @@ void LoRaGWMac::handleLowerMessage(cMessage *msg)
 void LoRaGWMac::sendPacketBack(Packet *receivedFrame)
 {
     const auto &frame = receivedFrame->peekAtFront<LoRaMacFrame>();
-    EV << "sending Data frame back" << endl;
+    EV_DEBUG << "sending Data frame back" << endl;
     auto pktBack = new Packet("LoraPacket");
     auto frameToSend = makeShared<LoRaMacFrame>();
     frameToSend->setChunkLength(B(par("headerLength").intValue()));
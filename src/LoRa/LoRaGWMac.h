@@ -26,6 +26,9 @@
 
 #include "LoRaMacControlInfo_m.h"
 #include "LoRaMacFrame_m.h"
+#include "LoRaFrameEvent.h"
+#include "LoRaClassBScheduler.h"
+#include <map>
 
 #if INET_VERSION < 0x0403 || ( INET_VERSION == 0x0403 && INET_PATCH_LEVEL == 0x00 )
 #  error At least INET 4.3.1 is required. Please update your INET dependency and fully rebuild the project.
@@ -37,25 +40,66 @@ using namespace inet::physicallayer;
 
 class LoRaGWMac: public MacProtocolBase {
 public:
-    bool waitingForDC;
-    cMessage *dutyCycleTimer;
+    cMessage *beaconTimer = nullptr;
     virtual void initialize(int stage) override;
     virtual void finish() override;
     //virtual InterfaceEntry *createInterfaceEntry();
     virtual void configureNetworkInterface() override;
     long GW_forwardedDown;
     long GW_droppedDC;
+    long numBeaconsSent = 0;
+    long numBeaconsSkipped = 0;
+    long numDownlinksReslotted = 0;
+    long numRejectedTooLate = 0;
+    long numRejectedConflict = 0;
+    long numRejectedQueueFull = 0;
+
+    static simsignal_t jitQueueLengthSignal;
+    static simsignal_t downlinkRejectedSignal;
 
     virtual void handleUpperMessage(cMessage *msg) override;
     virtual void handleLowerMessage(cMessage *msg) override;
     virtual void handleSelfMessage(cMessage *message) override;
 
     void sendPacketBack(Packet *receivedFrame);
+    void emitFrameEvent(const Ptr<const LoRaMacFrame>& frame, LoRaFrameEvent::Outcome outcome);
     void createFakeLoRaMacFrame();
+    void sendBeacon();
+    simtime_t getDutyCycleOffTime(int spreadFactor);
+    simtime_t findDownlinkSlot(simtime_t earliest, simtime_t latest, simtime_t span);
+    void sendScheduledDownlink();
+    void rejectDownlink(Packet *pkt, LoRaFrameEvent::Outcome reason);
     virtual MacAddress getAddress();
 
 protected:
     MacAddress address;
+    LoRaClassBScheduler *classBScheduler = nullptr;
+    /** Time between the beacons of this gateway, the beacon period times the number of beaconing gateways */
+    simtime_t beaconInterval;
+    /** Turn of this gateway among the beaconing gateways */
+    int beaconTurn = -1;
+
+    /**
+     * A downlink waiting in the just-in-time queue. It keeps the gateway busy
+     * from its start until its duty cycle off time has passed.
+     */
+    struct ScheduledDownlink
+    {
+        Packet *packet = nullptr;
+        simtime_t busyUntil;
+    };
+
+    /** @name Just-in-time downlink queue */
+    //@{
+    /** Accepted downlinks keyed by their transmission start time */
+    std::multimap<simtime_t, ScheduledDownlink> jitQueue;
+    cMessage *jitTimer = nullptr;
+    /** End of the duty cycle off time of the last downlink sent */
+    simtime_t dutyCycleEndTime = 0;
+    simtime_t receiveWindowLength;
+    simtime_t pingSlotLength;
+    int maxQueueSize = -1;
+    //@}
 
     IRadio *radio = nullptr;
     IRadio::TransmissionState transmissionState = IRadio::TRANSMISSION_STATE_UNDEFINED;
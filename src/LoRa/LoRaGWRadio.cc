@@ -41,6 +41,13 @@ void LoRaGWRadio::finish()
 {
     FlatRadioBase::finish();
     recordScalar("DER - Data Extraction Rate", double(LoRaGWRadioReceptionFinishedCorrect_counter)/LoRaGWRadioReceptionStarted_counter);
+    long numHalfDuplexLostTotal = 0;
+    for (int i = 0; i < 6; i++) {
+        const std::string stringScalar = "numHalfDuplexLost SF" + std::to_string(i + 7);
+        recordScalar(stringScalar.c_str(), numHalfDuplexLost[i]);
+        numHalfDuplexLostTotal += numHalfDuplexLost[i];
+    }
+    recordScalar("numHalfDuplexLost", numHalfDuplexLostTotal);
 }
 
 void LoRaGWRadio::handleSelfMessage(cMessage *message)
@@ -79,7 +86,7 @@ void LoRaGWRadio::handleUpperPacket(Packet *packet)
 {
     emit(packetReceivedFromUpperSignal, packet);
 
-    EV << packet->getDetailStringRepresentation(evFlags) << endl;
+    EV_DEBUG << packet->getDetailStringRepresentation(evFlags) << endl;
     const auto &frame = packet->peekAtFront<LoRaMacFrame>();
 
     auto preamble = makeShared<LoRaPhyPreamble>();
@@ -99,7 +106,7 @@ void LoRaGWRadio::handleUpperPacket(Packet *packet)
 //
     preamble->setChunkLength(b(16));
     packet->insertAtFront(preamble);
-    EV << "Wysylam " << preamble->getPower() << " " << preamble->getSpreadFactor() << endl;
+    EV_DEBUG << "Wysylam " << preamble->getPower() << " " << preamble->getSpreadFactor() << endl;
 
 
     if (separateTransmissionParts)
@@ -121,7 +128,7 @@ void LoRaGWRadio::startTransmission(Packet *macFrame, IRadioSignal::SignalPart p
         txTimer->setContextPointer(radioFrame);
         scheduleAt(transmission->getEndTime(part), txTimer);
         emit(transmissionStartedSignal, check_and_cast<const cObject *>(transmission));
-        EV_INFO << "Transmission started: " << (IWirelessSignal *)radioFrame << " " << IRadioSignal::getSignalPartName(part) << " as " << transmission << endl;
+        EV_DETAIL << "Transmission started: " << (IWirelessSignal *)radioFrame << " " << IRadioSignal::getSignalPartName(part) << " as " << transmission << endl;
         check_and_cast<LoRaMedium *>(medium.get())->emit(IRadioMedium::signalDepartureStartedSignal, check_and_cast<const cObject *>(transmission));    }
     else delete macFrame;
 }
@@ -132,21 +139,22 @@ void LoRaGWRadio::continueTransmission(cMessage *timer)
     auto nextPart = (IRadioSignal::SignalPart)(previousPart + 1);
     auto radioFrame = static_cast<IWirelessSignal *>(timer->getContextPointer());
     auto transmission = radioFrame->getTransmission();
-    EV_INFO << "Transmission ended: " << (IWirelessSignal *)radioFrame << " " << IRadioSignal::getSignalPartName(previousPart) << " as " << radioFrame->getTransmission() << endl;
+    EV_DETAIL << "Transmission ended: " << (IWirelessSignal *)radioFrame << " " << IRadioSignal::getSignalPartName(previousPart) << " as " << radioFrame->getTransmission() << endl;
     timer->setKind(nextPart);
     scheduleAt(transmission->getEndTime(nextPart), timer);
-    EV_INFO << "Transmission started: " << (IWirelessSignal *)radioFrame << " " << IRadioSignal::getSignalPartName(nextPart) << " as " << transmission << endl;
+    EV_DETAIL << "Transmission started: " << (IWirelessSignal *)radioFrame << " " << IRadioSignal::getSignalPartName(nextPart) << " as " << transmission << endl;
 }
 
 void LoRaGWRadio::endTransmission(cMessage *timer)
 {
     iAmTransmiting = false;
+    lastTransmissionEndTime = simTime();
     auto part = (IRadioSignal::SignalPart)timer->getKind();
     auto signal = static_cast<WirelessSignal *>(timer->getContextPointer());
     auto transmission = signal->getTransmission();
     timer->setContextPointer(nullptr);
 //    concurrentTransmissions.remove(timer);
-    EV_INFO << "Transmission ended: " << (IWirelessSignal *)signal << " " << IRadioSignal::getSignalPartName(part) << " as " << transmission << endl;
+    EV_DETAIL << "Transmission ended: " << (IWirelessSignal *)signal << " " << IRadioSignal::getSignalPartName(part) << " as " << transmission << endl;
     emit(transmissionEndedSignal, check_and_cast<const cObject *>(transmission));
     check_and_cast<LoRaMedium *>(medium.get())->emit(IRadioMedium::signalDepartureEndedSignal, check_and_cast<const cObject *>(transmission));
     delete(timer);
@@ -161,6 +169,30 @@ void LoRaGWRadio::handleSignal(WirelessSignal *radioFrame)
         startReception(receptionTimer, IRadioSignal::SIGNAL_PART_WHOLE);
 }
 
+void LoRaGWRadio::handleArrival(const ITransmission *transmission)
+{
+    Enter_Method_Silent();
+    if (!isReceiverMode(radioMode))
+        return;
+    auto radioFrame = check_and_cast<LoRaMedium *>(medium.get())->createArrivalSignal(this, transmission);
+    if (radioFrame->getArrival()->getStartTime() == simTime())
+        handleSignal(radioFrame);
+    else {
+        auto timer = createReceptionTimer(radioFrame);
+        timer->setKind(PENDING_ARRIVAL_KIND);
+        scheduleAt(radioFrame->getArrival()->getStartTime(), timer);
+    }
+}
+
+void LoRaGWRadio::handleReceptionTimer(cMessage *message)
+{
+    if (message->getKind() == PENDING_ARRIVAL_KIND)
+        // arrival delivered ahead of its start time by the medium
+        startReception(message, separateReceptionParts ? IRadioSignal::SIGNAL_PART_PREAMBLE : IRadioSignal::SIGNAL_PART_WHOLE);
+    else
+        FlatRadioBase::handleReceptionTimer(message);
+}
+
 bool LoRaGWRadio::isReceptionTimer(const cMessage *message) const
 {
     return !strcmp(message->getName(), "receptionTimer");
@@ -177,7 +209,7 @@ void LoRaGWRadio::startReception(cMessage *timer, IRadioSignal::SignalPart part)
     if (isReceiverMode(radioMode) && arrival->getStartTime(part) == simTime() && iAmTransmiting == false) {
         auto transmission = radioFrame->getTransmission();
         auto isReceptionAttempted = medium->isReceptionAttempted(this, transmission, part);
-        EV_INFO << "LoRaGWRadio Reception started: " << (isReceptionAttempted ? "attempting" : "not attempting") << " " << (WirelessSignal *)radioFrame << " " << IRadioSignal::getSignalPartName(part) << " as " << reception << endl;
+        EV_DETAIL << "LoRaGWRadio Reception started: " << (isReceptionAttempted ? "attempting" : "not attempting") << " " << (WirelessSignal *)radioFrame << " " << IRadioSignal::getSignalPartName(part) << " as " << reception << endl;
         if (isReceptionAttempted) {
             if(iAmGateway) {
                 concurrentReceptions.push_back(timer);
@@ -186,14 +218,14 @@ void LoRaGWRadio::startReception(cMessage *timer, IRadioSignal::SignalPart part)
         }
     }
     else
-        EV_INFO << "LoRaGWRadio Reception started: ignoring " << (WirelessSignal *)radioFrame << " " << IRadioSignal::getSignalPartName(part) << " as " << reception << endl;
+        EV_DETAIL << "LoRaGWRadio Reception started: ignoring " << (WirelessSignal *)radioFrame << " " << IRadioSignal::getSignalPartName(part) << " as " << reception << endl;
     timer->setKind(part);
     scheduleAt(arrival->getEndTime(part), timer);
     //updateTransceiverState();
     //updateTransceiverPart();
     radioMode = RADIO_MODE_TRANSCEIVER;
     check_and_cast<LoRaMedium *>(medium.get())->emit(IRadioMedium::signalArrivalStartedSignal, check_and_cast<const cObject *>(reception));
-    if(iAmGateway) EV << "[MSDebug] start reception, size : " << concurrentReceptions.size() << endl;
+    if(iAmGateway) EV_DEBUG << "[MSDebug] start reception, size : " << concurrentReceptions.size() << endl;
 }
 
 void LoRaGWRadio::continueReception(cMessage *timer)
@@ -212,21 +244,21 @@ void LoRaGWRadio::continueReception(cMessage *timer)
     if (timer == receptionTimer && isReceiverMode(radioMode) && arrival->getEndTime(previousPart) == simTime() && iAmTransmiting == false) {
         auto transmission = radioFrame->getTransmission();
         bool isReceptionSuccessful = medium->isReceptionSuccessful(this, transmission, previousPart);
-        EV_INFO << "LoRaGWRadio Reception ended: " << (isReceptionSuccessful ? "successfully" : "unsuccessfully") << " for " << (IWirelessSignal *)radioFrame << " " << IRadioSignal::getSignalPartName(previousPart) << " as " << reception << endl;
+        EV_DETAIL << "LoRaGWRadio Reception ended: " << (isReceptionSuccessful ? "successfully" : "unsuccessfully") << " for " << (IWirelessSignal *)radioFrame << " " << IRadioSignal::getSignalPartName(previousPart) << " as " << reception << endl;
         if (!isReceptionSuccessful) {
             receptionTimer = nullptr;
             if(iAmGateway) concurrentReceptions.remove(timer);
         }
         auto isReceptionAttempted = medium->isReceptionAttempted(this, transmission, nextPart);
-        EV_INFO << "LoRaGWRadio Reception started: " << (isReceptionAttempted ? "attempting" : "not attempting") << " " << (IWirelessSignal *)radioFrame << " " << IRadioSignal::getSignalPartName(nextPart) << " as " << reception << endl;
+        EV_DETAIL << "LoRaGWRadio Reception started: " << (isReceptionAttempted ? "attempting" : "not attempting") << " " << (IWirelessSignal *)radioFrame << " " << IRadioSignal::getSignalPartName(nextPart) << " as " << reception << endl;
         if (!isReceptionAttempted) {
             receptionTimer = nullptr;
             if(iAmGateway) concurrentReceptions.remove(timer);
         }
     }
     else {
-        EV_INFO << "LoRaGWRadio Reception ended: ignoring " << (IWirelessSignal *)radioFrame << " " << IRadioSignal::getSignalPartName(previousPart) << " as " << reception << endl;
-        EV_INFO << "LoRaGWRadio Reception started: ignoring " << (IWirelessSignal *)radioFrame << " " << IRadioSignal::getSignalPartName(nextPart) << " as " << reception << endl;
+        EV_DETAIL << "LoRaGWRadio Reception ended: ignoring " << (IWirelessSignal *)radioFrame << " " << IRadioSignal::getSignalPartName(previousPart) << " as " << reception << endl;
+        EV_DETAIL << "LoRaGWRadio Reception started: ignoring " << (IWirelessSignal *)radioFrame << " " << IRadioSignal::getSignalPartName(nextPart) << " as " << reception << endl;
     }
     timer->setKind(nextPart);
     scheduleAt(arrival->getEndTime(nextPart), timer);
@@ -247,11 +279,21 @@ void LoRaGWRadio::endReception(cMessage *timer)
             if(*it == timer) receptionTimer = timer;
         }
     }
-    if (timer == receptionTimer && isReceiverMode(radioMode) && arrival->getEndTime() == simTime() && iAmTransmiting == false) {
+    // the radio is half-duplex: a downlink overlapping any part of the arrival blinds the gateway
+    bool blinded = arrival->getEndTime() == simTime() && isBlindedByTransmission(arrival);
+    if (timer == receptionTimer && isReceiverMode(radioMode) && arrival->getEndTime() == simTime() && !blinded) {
         auto transmission = radioFrame->getTransmission();
 // TODO: this would draw twice from the random number generator in isReceptionSuccessful: auto isReceptionSuccessful = medium->isReceptionSuccessful(this, transmission, part);
-        auto isReceptionSuccessful = medium->getReceptionDecision(this, radioFrame->getListening(), transmission, part)->isReceptionSuccessful();
-        EV_INFO << "LoRaGWRadio Reception ended: " << (isReceptionSuccessful ? "successfully" : "unsuccessfully") << " for " << (IWirelessSignal *)radioFrame << " " << IRadioSignal::getSignalPartName(part) << " as " << reception << endl;
+        auto decision = medium->getReceptionDecision(this, radioFrame->getListening(), transmission, part);
+        auto isReceptionSuccessful = decision->isReceptionSuccessful();
+        EV_DETAIL << "LoRaGWRadio Reception ended: " << (isReceptionSuccessful ? "successfully" : "unsuccessfully") << " for " << (IWirelessSignal *)radioFrame << " " << IRadioSignal::getSignalPartName(part) << " as " << reception << endl;
+        if (mayHaveListeners(LoRaFrameEvent::loRaFrameEventSignal)) {
+            // LoRaReceiver reports a collision by refusing to attempt the reception
+            LoRaFrameEvent::Outcome outcome = isReceptionSuccessful ? LoRaFrameEvent::RX_OK :
+                    !decision->isReceptionPossible() ? LoRaFrameEvent::RX_BELOW_SENSITIVITY :
+                    !decision->isReceptionAttempted() ? LoRaFrameEvent::RX_COLLISION : LoRaFrameEvent::RX_IGNORED;
+            emitFrameEvent(radioFrame, outcome);
+        }
         if(isReceptionSuccessful) {
             auto macFrame = medium->receivePacket(this, radioFrame);
             take(macFrame);
@@ -259,14 +301,29 @@ void LoRaGWRadio::endReception(cMessage *timer)
             emit(LoRaGWRadioReceptionFinishedCorrect, true);
             if (simTime() >= getSimulation()->getWarmupPeriod())
                 LoRaGWRadioReceptionFinishedCorrect_counter++;
-            EV << macFrame->getCompleteStringRepresentation(evFlags) << endl;
+            EV_DEBUG << macFrame->getCompleteStringRepresentation(evFlags) << endl;
+            check_and_cast<const LoRaReceiver *>(receiver)->addErrorRateInd(macFrame, medium->getSNIR(this, transmission));
             sendUp(macFrame);
         }
         receptionTimer = nullptr;
         if(iAmGateway) concurrentReceptions.remove(timer);
     }
-    else
-        EV_INFO << "LoRaGWRadio Reception ended: ignoring " << (IWirelessSignal *)radioFrame << " " << IRadioSignal::getSignalPartName(part) << " as " << reception << endl;
+    else {
+        EV_DETAIL << "LoRaGWRadio Reception ended: ignoring " << (IWirelessSignal *)radioFrame << " " << IRadioSignal::getSignalPartName(part) << " as " << reception << endl;
+        // only uplinks the gateway could have received count as half-duplex losses
+        bool halfDuplexLoss = blinded && medium->isReceptionPossible(this, radioFrame->getTransmission(), part);
+        if (halfDuplexLoss) {
+            int spreadFactor = check_and_cast<const LoRaReception *>(reception)->getLoRaSF();
+            if (simTime() >= getSimulation()->getWarmupPeriod())
+                numHalfDuplexLost[spreadFactor - 7]++;
+        }
+        if (mayHaveListeners(LoRaFrameEvent::loRaFrameEventSignal) && arrival->getEndTime() == simTime())
+            emitFrameEvent(radioFrame, halfDuplexLoss ? LoRaFrameEvent::RX_HALF_DUPLEX : LoRaFrameEvent::RX_IGNORED);
+        if (timer == receptionTimer)
+            receptionTimer = nullptr;
+        if (iAmGateway)
+            concurrentReceptions.remove(timer);
+    }
     //updateTransceiverState();
     //updateTransceiverPart();
     radioMode = RADIO_MODE_TRANSCEIVER;
@@ -274,12 +331,33 @@ void LoRaGWRadio::endReception(cMessage *timer)
     delete timer;
 }
 
+bool LoRaGWRadio::isBlindedByTransmission(const IArrival *arrival) const
+{
+    return iAmTransmiting || lastTransmissionEndTime > arrival->getStartTime();
+}
+
+void LoRaGWRadio::emitFrameEvent(const WirelessSignal *radioFrame, LoRaFrameEvent::Outcome outcome)
+{
+    auto transmission = radioFrame->getTransmission();
+    auto packet = transmission->getPacket();
+    auto preamble = packet->peekAtFront<LoRaPhyPreamble>();
+    auto frame = packet->peekDataAt<LoRaMacFrame>(preamble->getChunkLength());
+    auto loRaReception = check_and_cast<const LoRaReception *>(radioFrame->getReception());
+    LoRaFrameEvent event(LoRaFrameEvent::GW_RX, outcome);
+    event.nodeAddress = frame->getTransmitterAddress();
+    event.sequenceNumber = frame->getSequenceNumber();
+    event.spreadFactor = loRaReception->getLoRaSF();
+    event.power = math::mW2dBmW(loRaReception->getPower().get() * 1000);
+    event.snir = math::fraction2dB(medium->getSNIR(this, transmission)->getMin());
+    emit(LoRaFrameEvent::loRaFrameEventSignal, &event);
+}
+
 void LoRaGWRadio::abortReception(cMessage *timer)
 {
     auto radioFrame = static_cast<WirelessSignal *>(timer->getControlInfo());
     auto part = (IRadioSignal::SignalPart)timer->getKind();
     auto reception = radioFrame->getReception();
-    EV_INFO << "LoRaGWRadio Reception aborted: for " << (IWirelessSignal *)radioFrame << " " << IRadioSignal::getSignalPartName(part) << " as " << reception << endl;
+    EV_DETAIL << "LoRaGWRadio Reception aborted: for " << (IWirelessSignal *)radioFrame << " " << IRadioSignal::getSignalPartName(part) << " as " << reception << endl;
     if (timer == receptionTimer) {
         if(iAmGateway) concurrentReceptions.remove(timer);
         receptionTimer = nullptr;
@@ -25,10 +25,12 @@
 #include "inet/physicallayer/wireless/common//medium/RadioMedium.h"
 #include "LoRaPhy/LoRaMedium.h"
 #include "inet/common/LayeredProtocolBase.h"
+#include "LoRaPhy/ILoRaArrivalHandler.h"
+#include "LoRaFrameEvent.h"
 
 namespace flora {
 
-class LoRaGWRadio : public FlatRadioBase {
+class LoRaGWRadio : public FlatRadioBase, public ILoRaArrivalHandler {
 private:
     void completeRadioModeSwitch(RadioMode newRadioMode);
 protected:
@@ -37,8 +39,14 @@ protected:
     virtual void handleSelfMessage(cMessage *message) override;
     virtual void handleUpperPacket(Packet *packet) override;
     void handleSignal(WirelessSignal *radioFrame) override;
+    virtual void handleReceptionTimer(cMessage *message) override;
 
     bool iAmTransmiting;
+    /** End of the last downlink, to detect uplinks it overlapped only partially */
+    simtime_t lastTransmissionEndTime = -1;
+    /** Receivable uplinks lost because the gateway transmitted during them, per SF 7..12 */
+    long numHalfDuplexLost[6] = {};
+    virtual bool isBlindedByTransmission(const IArrival *arrival) const;
     virtual bool isTransmissionTimer(const cMessage *message) const;
     virtual void handleTransmissionTimer(cMessage *message) override;
     virtual void startTransmission(Packet *macFrame, IRadioSignal::SignalPart part) override;
@@ -51,10 +59,13 @@ protected:
     virtual void endReception(cMessage *timer) override;
     virtual void abortReception(cMessage *timer) override;
 
+    virtual void emitFrameEvent(const WirelessSignal *radioFrame, LoRaFrameEvent::Outcome outcome);
 
 public:
     bool iAmGateway;
 
+    virtual void handleArrival(const ITransmission *transmission) override;
+
     std::list<cMessage *>concurrentReceptions;
     std::list<cMessage *>concurrentTransmissions;
 
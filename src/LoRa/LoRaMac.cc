@@ -22,6 +22,8 @@
 #include "inet/linklayer/csmaca/CsmaCaMac.h"
 #include "LoRaMac.h"
 #include "LoRaTagInfo_m.h"
+#include "LoRaFrameEvent.h"
+#include "LoRaPhy/LoRaMedium.h"
 #include "inet/common/ProtocolTag_m.h"
 #include "inet/linklayer/common/InterfaceTag_m.h"
 
@@ -30,16 +32,61 @@ namespace flora {
 
 Define_Module(LoRaMac);
 
+simsignal_t LoRaMac::joinStartedSignal = cComponent::registerSignal("LoRa_JoinStarted");
+simsignal_t LoRaMac::joinCompletedSignal = cComponent::registerSignal("LoRa_JoinCompleted");
+
+#define NO NO_TRANSITION
+#define WS WINDOW_STATE
+const int LoRaMac::transitionTable[NUM_STATES][NUM_EVENTS] = {
+    //                upper     tx end  timer   rx start       for us  not us  dropped backoff   slot start   slot end
+    /* IDLE */        { TRANSMIT, NO,     NO,     NO,            NO,     NO,     NO,     NO,       LISTENING_B, NO   },
+    /* TRANSMIT */    { NO,       WS,     NO,     NO,            NO,     NO,     NO,     NO,       NO,          NO   },
+    /* WAIT_DELAY_1 */{ NO,       NO,     WS,     NO,            NO,     NO,     NO,     NO,       NO,          NO   },
+    /* LISTENING_1 */ { NO,       NO,     WS,     RECEIVING_1,   NO,     NO,     NO,     NO,       NO,          NO   },
+    /* RECEIVING_1 */ { NO,       NO,     NO,     NO,            WS,     WS,     WS,     NO,       NO,          NO   },
+    /* WAIT_DELAY_2 */{ NO,       NO,     WS,     NO,            NO,     NO,     NO,     NO,       NO,          NO   },
+    /* LISTENING_2 */ { NO,       NO,     WS,     RECEIVING_2,   NO,     NO,     NO,     NO,       NO,          NO   },
+    /* RECEIVING_2 */ { NO,       NO,     NO,     NO,            WS,     WS,     WS,     NO,       NO,          NO   },
+    /* BACKOFF */     { NO,       NO,     NO,     NO,            NO,     NO,     NO,     TRANSMIT, NO,          NO   },
+    /* LISTENING_C */ { TRANSMIT, NO,     WS,     RECEIVING_C,   NO,     NO,     NO,     NO,       NO,          NO   },
+    /* RECEIVING_C */ { NO,       NO,     NO,     NO,            WS,     WS,     WS,     NO,       NO,          NO   },
+    /* LISTENING_B */ { NO,       NO,     NO,     RECEIVING_B,   NO,     NO,     NO,     NO,       NO,          IDLE },
+    /* RECEIVING_B */ { NO,       NO,     NO,     NO,            WS,     WS,     WS,     NO,       NO,          NO   },
+    /* CAD_BACKOFF */ { NO,       NO,     NO,     NO,            NO,     NO,     NO,     TRANSMIT, NO,          NO   },
+};
+#undef NO
+#undef WS
+
+// Class B uses the Class A windows after an uplink, its beacon and ping slot
+// receptions start from IDLE. Class C keeps the RX1/RX2 timing of Class A
+// (and thus its ACK deadline), but listens continuously outside of RX1.
+const LoRaMac::State LoRaMac::windowStates[NUM_DEVICE_CLASSES][PHASE_DONE + 1] = {
+    /* CLASS_A */ { WAIT_DELAY_1, LISTENING_1, WAIT_DELAY_2, LISTENING_2, IDLE },
+    /* CLASS_B */ { WAIT_DELAY_1, LISTENING_1, WAIT_DELAY_2, LISTENING_2, IDLE },
+    /* CLASS_C */ { LISTENING_C,  LISTENING_1, LISTENING_C,  LISTENING_C, LISTENING_C },
+};
+
+const LoRaMac::Action LoRaMac::enterActions[NUM_STATES] = {
+    &LoRaMac::turnOffReceiver,          // IDLE
+    &LoRaMac::sendCurrentTransmission,  // TRANSMIT
+    &LoRaMac::turnOffReceiver,          // WAIT_DELAY_1
+    &LoRaMac::turnOnReceiver,           // LISTENING_1
+    nullptr,                            // RECEIVING_1
+    &LoRaMac::turnOffReceiver,          // WAIT_DELAY_2
+    &LoRaMac::turnOnReceiver,           // LISTENING_2
+    nullptr,                            // RECEIVING_2
+    &LoRaMac::scheduleRetransmission,   // BACKOFF
+    &LoRaMac::turnOnReceiver,           // LISTENING_C
+    nullptr,                            // RECEIVING_C
+    &LoRaMac::turnOnReceiver,           // LISTENING_B
+    nullptr,                            // RECEIVING_B
+    &LoRaMac::scheduleCadBackoff,       // CAD_BACKOFF
+};
+
 LoRaMac::~LoRaMac()
 {
-    cancelAndDelete(endTransmission);
-    cancelAndDelete(endReception);
-    cancelAndDelete(droppedPacket);
-    cancelAndDelete(endDelay_1);
-    cancelAndDelete(endListening_1);
-    cancelAndDelete(endDelay_2);
-    cancelAndDelete(endListening_2);
-    cancelAndDelete(mediumStateChange);
+    cancelAndDelete(windowTimer);
+    cancelAndDelete(joinTimer);
 }
 
 /****************************************************************
@@ -56,11 +103,44 @@ void LoRaMac::initialize(int stage)
         ackLength = par("ackLength");
         ackTimeout = par("ackTimeout");
         retryLimit = par("retryLimit");
-
-        waitDelay1Time = 1;
-        listening1Time = 1;
-        waitDelay2Time = 1;
-        listening2Time = 1;
+        const char *deviceClassString = par("deviceClass");
+        if (!strcmp(deviceClassString, "A"))
+            deviceClass = CLASS_A;
+        else if (!strcmp(deviceClassString, "B"))
+            deviceClass = CLASS_B;
+        else if (!strcmp(deviceClassString, "C"))
+            deviceClass = CLASS_C;
+        else
+            throw cRuntimeError("Unknown deviceClass '%s'", deviceClassString);
+        dutyCycle = par("dutyCycle");
+        if (dutyCycle <= 0 || dutyCycle > 1)
+            throw cRuntimeError("dutyCycle must be in (0, 1], got %g", dutyCycle);
+        retransmissionBackoffSlot = par("retransmissionBackoffSlot");
+        maxBackoffExponent = par("maxBackoffExponent");
+        pingSlotPeriodicity = par("pingSlotPeriodicity");
+        if (pingSlotPeriodicity < 0 || pingSlotPeriodicity > 7)
+            throw cRuntimeError("pingSlotPeriodicity must be in [0, 7], got %d", pingSlotPeriodicity);
+        beaconlessOperationTimeout = par("beaconlessOperationTimeout");
+        listenBeforeTalk = par("listenBeforeTalk");
+        cadThreshold = mW(math::dBmW2mW(par("cadThreshold")));
+        cadBackoffSlot = par("cadBackoffSlot");
+        maxCadDeferrals = par("maxCadDeferrals");
+        const char *activationString = par("activation");
+        if (!strcmp(activationString, "OTAA"))
+            overTheAirActivation = true;
+        else if (strcmp(activationString, "ABP"))
+            throw cRuntimeError("Unknown activation '%s'", activationString);
+        joinRequestLength = B(par("joinRequestLength"));
+        joinDutyCycleLimits = par("joinDutyCycleLimits");
+        joinBackoffSlot = par("joinBackoffSlot");
+        rejoinTime = par("rejoinTime");
+
+        waitDelay1Time = par("receiveDelay1");
+        listening1Time = par("receiveWindowLength");
+        waitDelay2Time = par("receiveDelay2").doubleValue() - waitDelay1Time - listening1Time;
+        listening2Time = listening1Time;
+        if (waitDelay2Time < 0)
+            throw cRuntimeError("receiveDelay2 must not open RX2 before the end of RX1");
 
         const char *addressString = par("address");
         if (!strcmp(addressString, "auto")) {
@@ -78,24 +158,24 @@ void LoRaMac::initialize(int stage)
         radioModule->subscribe(IRadio::transmissionStateChangedSignal, this);
         radioModule->subscribe(LoRaRadio::droppedPacket, this);
         radio = check_and_cast<IRadio *>(radioModule);
+        energyConsumer = dynamic_cast<LoRaEnergyConsumer *>(radioModule->getSubmodule("energyConsumer"));
+        // a continuously listening node only starts receptions of frames addressed to it
+        if (deviceClass == CLASS_C)
+            check_and_cast<LoRaRadio *>(radioModule)->setReceiverAddressFilter(address);
 
         // initialize self messages
-        endTransmission = new cMessage("Transmission");
-        endReception = new cMessage("Reception");
-        droppedPacket = new cMessage("Dropped Packet");
-        endDelay_1 = new cMessage("Delay_1");
-        endListening_1 = new cMessage("Listening_1");
-        endDelay_2 = new cMessage("Delay_2");
-        endListening_2 = new cMessage("Listening_2");
-        mediumStateChange = new cMessage("MediumStateChange");
+        windowTimer = new cMessage("windowTimer");
+        joinTimer = new cMessage("joinTimer");
 
         // set up internal queue
         txQueue = getQueue(gate(upperLayerInGateId));//check_and_cast<queueing::IPacketQueue *>(getSubmodule("queue"));
 
         // state variables
-        fsm.setName("LoRaMac State Machine");
+        state = IDLE;
+        windowPhase = PHASE_DONE;
         backoffPeriod = -1;
         retryCounter = 0;
+        joined = !overTheAirActivation;
 
         // sequence number for messages
         sequenceNumber = 0;
@@ -109,9 +189,21 @@ void LoRaMac::initialize(int stage)
         numReceived = 0;
         numSentBroadcast = 0;
         numReceivedBroadcast = 0;
+        numConfirmed = 0;
+        numAcked = 0;
+        numBeaconsReceived = 0;
+        numSlotsOpened = 0;
+        numPingSlotDownlinks = 0;
+        numCadBusy = 0;
+        numCadDeferralsExhausted = 0;
+        numJoinRequests = 0;
+        joinLatency.setName("joinLatency");
+        attemptsPerDelivery.setName("attemptsPerDelivery");
+        deliveryLatency.setName("deliveryLatency");
 
         // initialize watches
-        WATCH(fsm);
+        WATCH(state);
+        WATCH(windowPhase);
         WATCH(backoffPeriod);
         WATCH(retryCounter);
         WATCH(numRetry);
@@ -122,9 +214,32 @@ void LoRaMac::initialize(int stage)
         WATCH(numReceived);
         WATCH(numSentBroadcast);
         WATCH(numReceivedBroadcast);
+        WATCH(numConfirmed);
+        WATCH(numAcked);
+        WATCH(numBeaconsReceived);
+        WATCH(numSlotsOpened);
+        WATCH(numPingSlotDownlinks);
+        WATCH(cadDeferrals);
+        WATCH(numCadBusy);
+        WATCH(joined);
+        WATCH(numJoinRequests);
     }
-    else if (stage == INITSTAGE_LINK_LAYER)
+    else if (stage == INITSTAGE_LINK_LAYER) {
         radio->setRadioMode(IRadio::RADIO_MODE_SLEEP);
+        if (deviceClass == CLASS_B) {
+            auto classBScheduler = getModuleFromPar<LoRaClassBScheduler>(par("classBSchedulerModule"), this);
+            classBScheduler->registerNode(this);
+            beaconCF = classBScheduler->getBeaconCF();
+            beaconSF = classBScheduler->getBeaconSF();
+            beaconBW = classBScheduler->getBeaconBW();
+        }
+        if (deviceClass == CLASS_C)
+            enterState(LISTENING_C);
+        if (overTheAirActivation)
+            scheduleAt(simTime() + par("joinDelay").doubleValue(), joinTimer);
+        else if (rejoinTime >= 0)
+            throw cRuntimeError("rejoinTime requires OTAA activation");
+    }
 }
 
 void LoRaMac::finish()
@@ -137,6 +252,25 @@ void LoRaMac::finish()
     recordScalar("numReceived", numReceived);
     recordScalar("numSentBroadcast", numSentBroadcast);
     recordScalar("numReceivedBroadcast", numReceivedBroadcast);
+    recordScalar("numConfirmed", numConfirmed);
+    recordScalar("numAcked", numAcked);
+    attemptsPerDelivery.recordAs("attemptsPerDelivery");
+    deliveryLatency.recordAs("deliveryLatency", "s");
+    if (energyConsumer != nullptr && numAcked > 0)
+        recordScalar("energyPerDeliveredPacket", energyConsumer->getTotalEnergyConsumed() / numAcked, "J");
+    if (deviceClass == CLASS_B) {
+        recordScalar("numBeaconsReceived", numBeaconsReceived);
+        recordScalar("numSlotsOpened", numSlotsOpened);
+        recordScalar("numPingSlotDownlinks", numPingSlotDownlinks);
+    }
+    if (listenBeforeTalk) {
+        recordScalar("numCadBusy", numCadBusy);
+        recordScalar("numCadDeferralsExhausted", numCadDeferralsExhausted);
+    }
+    if (overTheAirActivation) {
+        recordScalar("numJoinRequests", numJoinRequests);
+        joinLatency.recordAs("joinLatency", "s");
+    }
 }
 
 void LoRaMac::configureNetworkInterface()
@@ -160,8 +294,25 @@ void LoRaMac::configureNetworkInterface()
  */
 void LoRaMac::handleSelfMessage(cMessage *msg)
 {
-    EV << "received self message: " << msg << endl;
-    handleWithFsm(msg);
+    EV_DEBUG << "received self message: " << msg << endl;
+    if (msg == windowTimer && (msg->getKind() == PHASE_BACKOFF || msg->getKind() == PHASE_CAD_BACKOFF)) {
+        windowPhase = PHASE_DONE;
+        handleWithFsm(EVENT_BACKOFF_END);
+    }
+    else if (msg == joinTimer) {
+        startJoin();
+        // the mass rejoin scenario: all nodes lose their session at the same time
+        if (rejoinTime > simTime())
+            scheduleAt(rejoinTime + par("joinDelay").doubleValue(), joinTimer);
+    }
+    else if (msg == windowTimer) {
+        windowPhase = msg->getKind() + 1;
+        if (windowPhase != PHASE_DONE)
+            scheduleWindowTimer();
+        handleWithFsm(EVENT_WINDOW_TIMER);
+    }
+    else
+        throw cRuntimeError("Unknown self message '%s'", msg->getName());
 }
 #if 0
 void LoRaMac::handleUpperPacket(cMessage *msg)
@@ -177,11 +328,11 @@ void LoRaMac::handleUpperPacket(cMessage *msg)
 
     const auto &frame = pktEncap->peekAtFront<LoRaMacFrame>();
 
-    EV << "frame " << pktEncap << " received from higher layer, receiver = " << frame->getReceiverAddress() << endl;
+    EV_DEBUG << "frame " << pktEncap << " received from higher layer, receiver = " << frame->getReceiverAddress() << endl;
 
     txQueue->enqueuePacket(pktEncap);
     if (fsm.getState() != IDLE)
-        EV << "deferring upper message transmission in " << fsm.getStateName() << " state\n";
+        EV_DEBUG << "deferring upper message transmission in " << fsm.getStateName() << " state\n";
     else {
         popTxQueue();
         handleWithFsm(currentTxFrame);
@@ -190,12 +341,18 @@ void LoRaMac::handleUpperPacket(cMessage *msg)
 #endif
 void LoRaMac::handleUpperPacket(Packet *packet)
 {
-    if(fsm.getState() != IDLE) {
-         error("Wrong, it should not happen erroneous state: %s", fsm.getStateName());
+    if (!isIdle()) {
+         error("Wrong, it should not happen erroneous state: %s", getStateName(state));
     }
+    prepareUpperPacket(packet);
+    handleWithFsm(EVENT_UPPER_PACKET);
+}
+
+void LoRaMac::prepareUpperPacket(Packet *packet)
+{
     packet->addTagIfAbsent<PacketProtocolTag>()->setProtocol(&Protocol::apskPhy);
 
-    EV << "frame " << packet << " received from higher layer " << endl;
+    EV_DEBUG << "frame " << packet << " received from higher layer " << endl;
     auto pktEncap = encapsulate(packet);
     const auto &frame = pktEncap->peekAtFront<LoRaMacFrame>();
     if (frame == nullptr)
@@ -204,14 +361,38 @@ void LoRaMac::handleUpperPacket(Packet *packet)
     if (currentTxFrame != nullptr)
         throw cRuntimeError("Model error: incomplete transmission exists");
     currentTxFrame = pktEncap;
-    handleWithFsm(currentTxFrame);
 }
 
-
 void LoRaMac::handleLowerPacket(Packet *msg)
 {
-    if( (fsm.getState() == RECEIVING_1) || (fsm.getState() == RECEIVING_2)) handleWithFsm(msg);
-    else delete msg;
+    if (state == RECEIVING_1 || state == RECEIVING_2 || state == RECEIVING_C || state == RECEIVING_B) {
+        const auto &frame = msg->peekAtFront<LoRaMacFrame>();
+        if (frame->getBeacon()) {
+            numBeaconsReceived++;
+            lastBeaconTime = simTime();
+        }
+        handleWithFsm(isForUs(frame) ? EVENT_FRAME_FOR_US : EVENT_FRAME_NOT_FOR_US, msg);
+    }
+    else
+        delete msg;
+}
+
+void LoRaMac::handleClassBWakeup(bool open, bool beaconWindow)
+{
+    Enter_Method_Silent();
+    if (open && state == IDLE) {
+        numSlotsOpened++;
+        // the receiver only accepts frames on its own CF/SF/BW, and beacons
+        // keep theirs whatever ADR did to the uplink settings
+        if (beaconWindow)
+            tuneToBeacon();
+    }
+    handleWithFsm(open ? EVENT_SLOT_START : EVENT_SLOT_END);
+}
+
+bool LoRaMac::isBeaconLocked()
+{
+    return lastBeaconTime >= 0 && simTime() - lastBeaconTime <= beaconlessOperationTimeout;
 }
 
 void LoRaMac::processUpperPacket()
@@ -228,7 +409,7 @@ queueing::IPassivePacketSource *LoRaMac::getProvider(cGate *gate)
 void LoRaMac::handleCanPullPacketChanged(cGate *gate)
 {
     Enter_Method("handleCanPullPacketChanged");
-    if (fsm.getState() == IDLE && !txQueue->isEmpty()) {
+    if (isIdle() && joined && currentTxFrame == nullptr && !txQueue->isEmpty()) {
         processUpperPacket();
     }
 }
@@ -239,146 +420,86 @@ void LoRaMac::handlePullPacketProcessed(Packet *packet, cGate *gate, bool succes
     throw cRuntimeError("Not supported callback");
 }
 
-void LoRaMac::handleWithFsm(cMessage *msg)
+void LoRaMac::handleWithFsm(Event event, Packet *packet)
 {
-    Ptr<LoRaMacFrame>frame = nullptr;
-
-    auto pkt = dynamic_cast<Packet *>(msg);
-    if (pkt) {
-        const auto &chunk = pkt->peekAtFront<Chunk>();
-        frame = dynamicPtrCast<LoRaMacFrame>(constPtrCast<Chunk>(chunk));
-    }
-    FSMA_Switch(fsm)
-    {
-        FSMA_State(IDLE)
-        {
-            FSMA_Enter(turnOffReceiver());
-            FSMA_Event_Transition(Idle-Transmit,
-                                  isUpperMessage(msg),
-                                  TRANSMIT,
-            );
-        }
-        FSMA_State(TRANSMIT)
-        {
-            FSMA_Enter(sendDataFrame(getCurrentTransmission()));
-            FSMA_Event_Transition(Transmit-Wait_Delay_1,
-                                  msg == endTransmission,
-                                  WAIT_DELAY_1,
-                finishCurrentTransmission();
-                numSent++;
-            );
+    // Events never re-enter this function: once the machine settles in idle
+    // the next queued packet is pulled and dispatched by this loop instead.
+    while (true) {
+        int target = transitionTable[state][event];
+        if (target == NO_TRANSITION) {
+            EV_TRACE << "event " << event << " ignored in " << getStateName(state) << " state" << endl;
+            delete packet;
         }
-        FSMA_State(WAIT_DELAY_1)
-        {
-            FSMA_Enter(turnOffReceiver());
-            FSMA_Event_Transition(Wait_Delay_1-Listening_1,
-                                  msg == endDelay_1 || endDelay_1->isScheduled() == false,
-                                  LISTENING_1,
-            );
-        }
-        FSMA_State(LISTENING_1)
-        {
-            FSMA_Enter(turnOnReceiver());
-            FSMA_Event_Transition(Listening_1-Wait_Delay_2,
-                                  msg == endListening_1 || endListening_1->isScheduled() == false,
-                                  WAIT_DELAY_2,
-            );
-            FSMA_Event_Transition(Listening_1-Receiving1,
-                                  msg == mediumStateChange && isReceiving(),
-                                  RECEIVING_1,
-            );
-        }
-        FSMA_State(RECEIVING_1)
-        {
-            FSMA_Event_Transition(Receive-Unicast-Not-For,
-                                  isLowerMessage(msg) && !isForUs(frame),
-                                  LISTENING_1,
-            );
-            FSMA_Event_Transition(Receive-Unicast,
-                                  isLowerMessage(msg) && isForUs(frame),
-                                  IDLE,
-                sendUp(decapsulate(pkt));
-                numReceived++;
-                cancelEvent(endListening_1);
-                cancelEvent(endDelay_2);
-                cancelEvent(endListening_2);
-            );
-            FSMA_Event_Transition(Receive-BelowSensitivity,
-                                  msg == droppedPacket,
-                                  LISTENING_1,
-            );
-
-        }
-        FSMA_State(WAIT_DELAY_2)
-        {
-            FSMA_Enter(turnOffReceiver());
-            FSMA_Event_Transition(Wait_Delay_2-Listening_2,
-                                  msg == endDelay_2 || endDelay_2->isScheduled() == false,
-                                  LISTENING_2,
-            );
-        }
-        FSMA_State(LISTENING_2)
-        {
-            FSMA_Enter(turnOnReceiver());
-            FSMA_Event_Transition(Listening_2-idle,
-                                  msg == endListening_2 || endListening_2->isScheduled() == false,
-                                  IDLE,
-            );
-            FSMA_Event_Transition(Listening_2-Receiving2,
-                                  msg == mediumStateChange && isReceiving(),
-                                  RECEIVING_2,
-            );
-        }
-        FSMA_State(RECEIVING_2)
-        {
-            FSMA_Event_Transition(Receive2-Unicast-Not-For,
-                                  isLowerMessage(msg) && !isForUs(frame),
-                                  LISTENING_2,
-            );
-            FSMA_Event_Transition(Receive2-Unicast,
-                                  isLowerMessage(msg) && isForUs(frame),
-                                  IDLE,
-                sendUp(pkt);
-                numReceived++;
-                cancelEvent(endListening_2);
-            );
-            FSMA_Event_Transition(Receive2-BelowSensitivity,
-                                  msg == droppedPacket,
-                                  LISTENING_2,
-            );
+        else {
+            switch (event) {
+                case EVENT_TRANSMISSION_END:
+                    finishCurrentTransmission();
+                    numSent++;
+                    break;
+                case EVENT_FRAME_FOR_US:
+                    if (packet->peekAtFront<LoRaMacFrame>()->getJoinAccept()) {
+                        if (isJoining())
+                            handleJoinAccept();
+                    }
+                    else if (isAck(packet->peekAtFront<LoRaMacFrame>()) && isWaitingForAck())
+                        handleAck();
+                    if (state == RECEIVING_B)
+                        numPingSlotDownlinks++;
+                    // the application may change the uplink settings, e.g. by ADR
+                    restoreUplinkTuning();
+                    decapsulate(packet);
+                    numReceived++;
+                    // a bare acknowledgment carries nothing for the application
+                    if (packet->getDataLength() > b(0))
+                        sendUp(packet);
+                    else
+                        delete packet;
+                    cancelEvent(windowTimer);
+                    windowPhase = PHASE_DONE;
+                    break;
+                case EVENT_FRAME_NOT_FOR_US:
+                    delete packet;
+                    break;
+                default:
+                    break;
+            }
+            State nextState = target == WINDOW_STATE ? resolveWindowState() : (State)target;
+            enterState(nextState == TRANSMIT ? resolveTransmitState() : nextState);
         }
+        packet = nullptr;
+
+        if (!isIdle() || currentTxFrame != nullptr)
+            break;
+        if (joinPending)
+            prepareJoinRequest();
+        else if (joined && !txQueue->isEmpty())
+            prepareUpperPacket(dequeuePacket());
+        else
+            break;
+        event = EVENT_UPPER_PACKET;
     }
+    getDisplayString().setTagArg("t", 0, getStateName(state));
+}
 
-//    if (fsm.getState() == IDLE) {
-//        if (isReceiving())
-//            handleWithFsm(mediumStateChange);
-//        else if (currentTxFrame != nullptr)
-//            handleWithFsm(currentTxFrame);
-//        else if (!txQueue->isEmpty()) {
-//            popTxQueue();
-//            handleWithFsm(currentTxFrame);
-//        }
-//    }
-
-    if (fsm.getState() == IDLE) {
-        if (isReceiving())
-            handleWithFsm(mediumStateChange);
-        else if (currentTxFrame != nullptr)
-            handleWithFsm(currentTxFrame);
-        else if (!txQueue->isEmpty()) {
-            processUpperPacket();
-        }
-    }
+void LoRaMac::enterState(State newState)
+{
+    EV_DEBUG << "state " << getStateName(state) << " -> " << getStateName(newState) << endl;
+    if (newState != LISTENING_B && newState != RECEIVING_B)
+        restoreUplinkTuning();
+    state = newState;
+    if (Action action = enterActions[state])
+        (this->*action)();
+}
 
-    if (endSifs) {
-        if (isLowerMessage(msg) && pkt->getOwner() == this && (endSifs->getContextPointer() != pkt))
-            delete pkt;
-    }
-    else {
-        if (isLowerMessage(msg) && pkt->getOwner() == this)
-            delete pkt;
-    }
-    getDisplayString().setTagArg("t", 0, fsm.getStateName());
+const char *LoRaMac::getStateName(State state)
+{
+    static const char *names[NUM_STATES] = {
+        "IDLE", "TRANSMIT", "WAIT_DELAY_1", "LISTENING_1", "RECEIVING_1",
+        "WAIT_DELAY_2", "LISTENING_2", "RECEIVING_2", "BACKOFF",
+        "LISTENING_C", "RECEIVING_C", "LISTENING_B", "RECEIVING_B",
+        "CAD_BACKOFF"
+    };
+    return names[state];
 }
 
 void LoRaMac::receiveSignal(cComponent *source, simsignal_t signalID, intval_t value, cObject *details)
@@ -390,17 +511,19 @@ void LoRaMac::receiveSignal(cComponent *source, simsignal_t signalID, intval_t v
             radio->setRadioMode(IRadio::RADIO_MODE_SLEEP);
         }
         receptionState = newRadioReceptionState;
-        handleWithFsm(mediumStateChange);
+        if (isReceiving())
+            handleWithFsm(EVENT_RECEPTION_START);
     }
     else if (signalID == LoRaRadio::droppedPacket) {
         radio->setRadioMode(IRadio::RADIO_MODE_SLEEP);
-        handleWithFsm(droppedPacket);
+        handleWithFsm(EVENT_FRAME_DROPPED);
     }
     else if (signalID == IRadio::transmissionStateChangedSignal) {
         IRadio::TransmissionState newRadioTransmissionState = (IRadio::TransmissionState)value;
         if (transmissionState == IRadio::TRANSMISSION_STATE_TRANSMITTING && newRadioTransmissionState == IRadio::TRANSMISSION_STATE_IDLE) {
-            handleWithFsm(endTransmission);
+            // sleep first, a Class C node turns its receiver back on in the state entered next
             radio->setRadioMode(IRadio::RADIO_MODE_SLEEP);
+            handleWithFsm(EVENT_TRANSMISSION_END);
         }
         transmissionState = newRadioTransmissionState;
     }
@@ -412,6 +535,8 @@ Packet *LoRaMac::encapsulate(Packet *msg)
     frame->setChunkLength(B(headerLength));
     msg->setArrival(msg->getArrivalModuleId(), msg->getArrivalGateId());
     auto tag = msg->getTag<LoRaTag>();
+    if (tag->getConfirmed())
+        numConfirmed++;
 
     frame->setTransmitterAddress(address);
     frame->setLoRaTP(tag->getPower().get());
@@ -420,6 +545,7 @@ Packet *LoRaMac::encapsulate(Packet *msg)
     frame->setLoRaBW(tag->getBandwidth());
     frame->setLoRaCR(tag->getCodeRendundance());
     frame->setSequenceNumber(sequenceNumber);
+    frame->setConfirmed(tag->getConfirmed());
     frame->setReceiverAddress(MacAddress::BROADCAST_ADDRESS);
 
     ++sequenceNumber;
@@ -450,7 +576,7 @@ Packet *LoRaMac::decapsulate(Packet *frame)
  */
 void LoRaMac::sendDataFrame(Packet *frameToSend)
 {
-    EV << "sending Data frame\n";
+    EV_DEBUG << "sending Data frame\n";
     radio->setRadioMode(IRadio::RADIO_MODE_TRANSMITTER);
 
     auto frameCopy = frameToSend->dup();
@@ -467,6 +593,15 @@ void LoRaMac::sendDataFrame(Packet *frameToSend)
 
     //frameCopy->addTag<PacketProtocolTag>()->setProtocol(&Protocol::lora);
 
+    if (mayHaveListeners(LoRaFrameEvent::loRaFrameEventSignal)) {
+        LoRaFrameEvent event(LoRaFrameEvent::UPLINK_TX, LoRaFrameEvent::OUTCOME_NONE);
+        event.nodeAddress = macHeader->getTransmitterAddress();
+        event.sequenceNumber = macHeader->getSequenceNumber();
+        event.spreadFactor = macHeader->getLoRaSF();
+        event.power = math::mW2dBmW(macHeader->getLoRaTP() * 1000); // uplinks carry the power in W
+        event.txPower = event.power;
+        emit(LoRaFrameEvent::loRaFrameEventSignal, &event);
+    }
     sendDown(frameCopy);
 }
 
@@ -477,7 +612,7 @@ void LoRaMac::sendAckFrame()
     auto macHeader = makeShared<CsmaCaMacAckHeader>();
     macHeader->setReceiverAddress(MacAddress(frameToAck->peekAtFront<LoRaMacFrame>()->getTransmitterAddress().getInt()));
 
-    EV << "sending Ack frame\n";
+    EV_DEBUG << "sending Ack frame\n";
     //auto macHeader = makeShared<CsmaCaMacAckHeader>();
     macHeader->setChunkLength(B(ackLength));
     auto frame = new Packet("CsmaAck");
@@ -497,14 +632,198 @@ void LoRaMac::sendAckFrame()
  */
 void LoRaMac::finishCurrentTransmission()
 {
-    scheduleAt(simTime() + waitDelay1Time, endDelay_1);
-    scheduleAt(simTime() + waitDelay1Time + listening1Time, endListening_1);
-    scheduleAt(simTime() + waitDelay1Time + listening1Time + waitDelay2Time, endDelay_2);
-    scheduleAt(simTime() + waitDelay1Time + listening1Time + waitDelay2Time + listening2Time, endListening_2);
-    deleteCurrentTxFrame();
+    windowPhase = PHASE_DELAY_1;
+    scheduleWindowTimer();
+    simtime_t airtime = simTime() - lastTransmissionStart;
+    double currentDutyCycle = isJoining() && joinDutyCycleLimits ? getJoinDutyCycle() : dutyCycle;
+    dutyCycleEndTime = simTime() + airtime * (1 / currentDutyCycle - 1);
+    // confirmed uplinks are kept until acknowledged or given up
+    if (!isWaitingForAck())
+        deleteCurrentTxFrame();
     //popTxQueue();
 }
 
+LoRaMac::State LoRaMac::resolveWindowState()
+{
+    if (windowPhase != PHASE_DONE || !isWaitingForAck())
+        return windowStates[deviceClass][windowPhase];
+    if (joinPending) {
+        // the session was lost meanwhile, the frame is abandoned and the node rejoins
+        retryCounter = 0;
+        deleteCurrentTxFrame();
+        return windowStates[deviceClass][PHASE_DONE];
+    }
+    // join requests are repeated until accepted, paced by the join duty cycle
+    if (isJoining() || retryCounter < retryLimit)
+        return BACKOFF;
+    EV_DETAIL << "giving up confirmed frame after " << retryCounter + 1 << " attempts" << endl;
+    numGivenUp++;
+    retryCounter = 0;
+    deleteCurrentTxFrame();
+    return windowStates[deviceClass][PHASE_DONE];
+}
+
+LoRaMac::State LoRaMac::resolveTransmitState()
+{
+    if (!listenBeforeTalk || !isChannelBusy()) {
+        cadDeferrals = 0;
+        return TRANSMIT;
+    }
+    numCadBusy++;
+    if (cadDeferrals < maxCadDeferrals)
+        return CAD_BACKOFF;
+    // do not starve, fall back to ALOHA once all deferrals are used up
+    EV_DETAIL << "channel still busy after " << cadDeferrals << " deferrals, transmitting anyway" << endl;
+    numCadDeferralsExhausted++;
+    cadDeferrals = 0;
+    return TRANSMIT;
+}
+
+bool LoRaMac::isChannelBusy()
+{
+    auto frame = getCurrentTransmission()->peekAtFront<LoRaMacFrame>();
+    auto medium = check_and_cast<const LoRaMedium *>(radio->getMedium());
+    return medium->isChannelActive(radio, frame->getLoRaCF(), frame->getLoRaSF(), cadThreshold);
+}
+
+bool LoRaMac::isIdle()
+{
+    return state == windowStates[deviceClass][PHASE_DONE];
+}
+
+void LoRaMac::handleAck()
+{
+    EV_DETAIL << "confirmed frame acknowledged after " << retryCounter + 1 << " attempts" << endl;
+    numAcked++;
+    if (retryCounter == 0)
+        numSentWithoutRetry++;
+    attemptsPerDelivery.collect(retryCounter + 1);
+    deliveryLatency.collect(simTime() - firstAttemptTime);
+    retryCounter = 0;
+    deleteCurrentTxFrame();
+}
+
+void LoRaMac::startJoin()
+{
+    EV_DETAIL << "starting over-the-air activation" << endl;
+    joined = false;
+    joinPending = true;
+    if (joinStartTime < 0) {
+        joinStartTime = simTime();
+        emit(joinStartedSignal, joinStartTime);
+    }
+    // a frame waiting for its retransmission is lost together with the session
+    if (state == BACKOFF || state == CAD_BACKOFF) {
+        cancelEvent(windowTimer);
+        windowPhase = PHASE_DONE;
+        retryCounter = 0;
+        cadDeferrals = 0;
+        deleteCurrentTxFrame();
+        enterState(windowStates[deviceClass][PHASE_DONE]);
+    }
+    // otherwise the join request is sent once the receive windows in progress end
+    if (isIdle() && currentTxFrame == nullptr) {
+        prepareJoinRequest();
+        handleWithFsm(EVENT_UPPER_PACKET);
+    }
+}
+
+void LoRaMac::prepareJoinRequest()
+{
+    LoRaRadio *loRaRadio = check_and_cast<LoRaRadio *>(radio);
+    auto frame = makeShared<LoRaMacFrame>();
+    frame->setChunkLength(joinRequestLength);
+    frame->setTransmitterAddress(address);
+    frame->setReceiverAddress(MacAddress::BROADCAST_ADDRESS);
+    frame->setJoinRequest(true);
+    // the DevNonce of a join request takes the place of the frame counter
+    frame->setSequenceNumber(devNonce++);
+    frame->setLoRaTP(math::dBmW2mW(loRaRadio->loRaTP) / 1000);
+    frame->setLoRaCF(loRaRadio->loRaCF);
+    frame->setLoRaSF(loRaRadio->loRaSF);
+    frame->setLoRaBW(loRaRadio->loRaBW);
+    frame->setLoRaCR(loRaRadio->loRaCR);
+    frame->setLoRaUseHeader(loRaRadio->loRaUseHeader);
+
+    auto packet = new Packet("JoinRequest");
+    packet->insertAtFront(frame);
+    packet->addTag<PacketProtocolTag>()->setProtocol(&Protocol::apskPhy);
+    if (currentTxFrame != nullptr)
+        throw cRuntimeError("Model error: incomplete transmission exists");
+    currentTxFrame = packet;
+    joined = false;
+    joinPending = false;
+    numJoinRequests++;
+}
+
+void LoRaMac::handleJoinAccept()
+{
+    EV_DETAIL << "joined after " << retryCounter + 1 << " join requests" << endl;
+    joined = true;
+    sequenceNumber = 0;
+    retryCounter = 0;
+    deleteCurrentTxFrame();
+    simtime_t latency = simTime() - joinStartTime;
+    joinLatency.collect(latency);
+    emit(joinCompletedSignal, latency);
+    joinStartTime = -1;
+}
+
+double LoRaMac::getJoinDutyCycle()
+{
+    // LoRaWAN 1.0.4 join-request retransmission back-off, applied per
+    // transmission: 36 s per hour in the first hour after the join started,
+    // 36 s per 10 hours during the next 10 hours, 8.7 s per 24 hours afterwards
+    simtime_t elapsed = simTime() - joinStartTime;
+    if (elapsed < 3600)
+        return 0.01;
+    if (elapsed < 11 * 3600)
+        return 0.001;
+    return 8.7 / (24 * 3600);
+}
+
+void LoRaMac::scheduleRetransmission()
+{
+    turnOffReceiver();
+    retryCounter++;
+    if (!isJoining())
+        numRetry++;
+    // randomised exponential backoff, started no earlier than the duty cycle allows
+    int exponent = std::min(retryCounter, maxBackoffExponent);
+    simtime_t slot = isJoining() ? joinBackoffSlot : retransmissionBackoffSlot;
+    simtime_t backoff = slot * uniform(0, (1 << exponent) - 1);
+    backoffPeriod = std::max(simTime(), dutyCycleEndTime) + backoff - simTime();
+    windowPhase = PHASE_BACKOFF;
+    windowTimer->setKind(PHASE_BACKOFF);
+    scheduleAt(simTime() + backoffPeriod, windowTimer);
+}
+
+void LoRaMac::scheduleCadBackoff()
+{
+    turnOffReceiver();
+    cadDeferrals++;
+    int exponent = std::min(cadDeferrals, maxBackoffExponent);
+    backoffPeriod = cadBackoffSlot * uniform(0, (1 << exponent) - 1);
+    EV_DETAIL << "channel busy, deferring transmission by " << backoffPeriod << endl;
+    windowPhase = PHASE_CAD_BACKOFF;
+    windowTimer->setKind(PHASE_CAD_BACKOFF);
+    scheduleAt(simTime() + backoffPeriod, windowTimer);
+}
+
+void LoRaMac::scheduleWindowTimer()
+{
+    simtime_t duration;
+    switch (windowPhase) {
+        case PHASE_DELAY_1: duration = waitDelay1Time; break;
+        case PHASE_LISTENING_1: duration = listening1Time; break;
+        case PHASE_DELAY_2: duration = waitDelay2Time; break;
+        case PHASE_LISTENING_2: duration = listening2Time; break;
+        default: throw cRuntimeError("Unknown window phase %d", windowPhase);
+    }
+    windowTimer->setKind(windowPhase);
+    scheduleAt(simTime() + duration, windowTimer);
+}
+
 Packet *LoRaMac::getCurrentTransmission()
 {
     ASSERT(currentTxFrame != nullptr);
@@ -518,7 +837,20 @@ bool LoRaMac::isReceiving()
 
 bool LoRaMac::isAck(const Ptr<const LoRaMacFrame> &frame)
 {
-    return false;//dynamic_cast<LoRaMacFrame *>(frame);
+    return frame->getAck();
+}
+
+bool LoRaMac::isWaitingForAck()
+{
+    if (currentTxFrame == nullptr)
+        return false;
+    auto frame = currentTxFrame->peekAtFront<LoRaMacFrame>();
+    return frame->getConfirmed() || frame->getJoinRequest();
+}
+
+bool LoRaMac::isJoining()
+{
+    return currentTxFrame != nullptr && currentTxFrame->peekAtFront<LoRaMacFrame>()->getJoinRequest();
 }
 
 bool LoRaMac::isBroadcast(const Ptr<const LoRaMacFrame> &frame)
@@ -538,6 +870,36 @@ void LoRaMac::turnOnReceiver()
     loraRadio->setRadioMode(IRadio::RADIO_MODE_RECEIVER);
 }
 
+void LoRaMac::tuneToBeacon()
+{
+    LoRaRadio *loraRadio = check_and_cast<LoRaRadio *>(radio);
+    uplinkCF = loraRadio->loRaCF;
+    uplinkSF = loraRadio->loRaSF;
+    uplinkBW = loraRadio->loRaBW;
+    loraRadio->loRaCF = beaconCF;
+    loraRadio->loRaSF = beaconSF;
+    loraRadio->loRaBW = beaconBW;
+}
+
+void LoRaMac::restoreUplinkTuning()
+{
+    if (uplinkSF == -1)
+        return;
+    LoRaRadio *loraRadio = check_and_cast<LoRaRadio *>(radio);
+    loraRadio->loRaCF = uplinkCF;
+    loraRadio->loRaSF = uplinkSF;
+    loraRadio->loRaBW = uplinkBW;
+    uplinkSF = -1;
+}
+
+void LoRaMac::sendCurrentTransmission()
+{
+    lastTransmissionStart = simTime();
+    if (retryCounter == 0)
+        firstAttemptTime = simTime();
+    sendDataFrame(getCurrentTransmission());
+}
+
 void LoRaMac::turnOffReceiver()
 {
     LoRaRadio *loraRadio;
@@ -4,7 +4,6 @@
 #include "inet/physicallayer/wireless/common/contract/packetlevel/IRadio.h"
 #include "inet/linklayer/contract/IMacProtocol.h"
 #include "inet/linklayer/base/MacProtocolBase.h"
-#include "inet/common/FSMA.h"
 #include "inet/queueing/contract/IPacketQueue.h"
 #include "LoRaMacControlInfo_m.h"
 #include "LoRaMacFrame_m.h"
@@ -14,6 +13,8 @@
 #include "inet/linklayer/contract/IMacProtocol.h"
 
 #include "LoRaRadio.h"
+#include "LoRaEnergyModules/LoRaEnergyConsumer.h"
+#include "LoRaClassBScheduler.h"
 
 namespace flora {
 
@@ -49,6 +50,23 @@ class LoRaMac : public MacProtocolBase, public IMacProtocol, public queueing::IA
     int cwMax = -1;
     int cwMulticast = -1;
     int sequenceNumber = 0;
+    double dutyCycle = NaN;
+    simtime_t retransmissionBackoffSlot = -1;
+    int maxBackoffExponent = -1;
+    int pingSlotPeriodicity = -1;
+    simtime_t beaconlessOperationTimeout = -1;
+    Hz beaconCF = Hz(NaN);
+    int beaconSF = -1;
+    Hz beaconBW = Hz(NaN);
+    bool listenBeforeTalk = false;
+    W cadThreshold = W(NaN);
+    simtime_t cadBackoffSlot = -1;
+    int maxCadDeferrals = -1;
+    bool overTheAirActivation = false;
+    b joinRequestLength = b(-1);
+    bool joinDutyCycleLimits = true;
+    simtime_t joinBackoffSlot = -1;
+    simtime_t rejoinTime = -1;
     //@}
 
     /** End of the Short Inter-Frame Time period */
@@ -77,13 +95,85 @@ class LoRaMac : public MacProtocolBase, public IMacProtocol, public queueing::IA
         WAIT_DELAY_2,
         LISTENING_2,
         RECEIVING_2,
+        BACKOFF,
+        LISTENING_C,
+        RECEIVING_C,
+        LISTENING_B,
+        RECEIVING_B,
+        CAD_BACKOFF,
+        NUM_STATES
+    };
+
+    /**
+     * LoRaWAN device class. Class B devices additionally listen for beacons
+     * and in their ping slots, woken up by the LoRaClassBScheduler. Class C
+     * devices listen continuously on the downlink channel whenever they are
+     * not transmitting or in RX1.
+     */
+    enum DeviceClass {
+        CLASS_A,
+        CLASS_B,
+        CLASS_C,
+        NUM_DEVICE_CLASSES
+    };
+
+    /**
+     * Inputs of the state machine. Radio signals and timers are mapped to
+     * these before dispatching, so no placeholder messages are needed.
+     */
+    enum Event {
+        EVENT_UPPER_PACKET,
+        EVENT_TRANSMISSION_END,
+        EVENT_WINDOW_TIMER,
+        EVENT_RECEPTION_START,
+        EVENT_FRAME_FOR_US,
+        EVENT_FRAME_NOT_FOR_US,
+        EVENT_FRAME_DROPPED,
+        EVENT_BACKOFF_END,
+        EVENT_SLOT_START,
+        EVENT_SLOT_END,
+        NUM_EVENTS
+    };
+
+    /**
+     * Phases of the Class A receive window sequence that follows an uplink.
+     * The phase advances each time the window timer fires, independently of
+     * whether a reception is ongoing; it is stored as the kind of the timer.
+     * PHASE_BACKOFF is the wait before retransmitting an unacknowledged
+     * confirmed uplink, PHASE_CAD_BACKOFF the deferral after channel
+     * activity detection found the channel busy.
+     */
+    enum WindowPhase {
+        PHASE_DELAY_1,
+        PHASE_LISTENING_1,
+        PHASE_DELAY_2,
+        PHASE_LISTENING_2,
+        PHASE_DONE,
+        PHASE_BACKOFF,
+        PHASE_CAD_BACKOFF
     };
 
     IRadio *radio = nullptr;
     IRadio::TransmissionState transmissionState = IRadio::TRANSMISSION_STATE_UNDEFINED;
     IRadio::ReceptionState receptionState = IRadio::RECEPTION_STATE_UNDEFINED;
 
-    cFSM fsm;
+    typedef void (LoRaMac::*Action)();
+
+    /** Transition target meaning "no transition, ignore the event" */
+    static const int NO_TRANSITION = -1;
+    /** Transition target meaning "the state belonging to the current window phase" */
+    static const int WINDOW_STATE = -2;
+
+    /** Target state (or one of the special values above) per state and event */
+    static const int transitionTable[NUM_STATES][NUM_EVENTS];
+    /** State to return to when a reception ends, per device class and window phase */
+    static const State windowStates[NUM_DEVICE_CLASSES][PHASE_DONE + 1];
+    /** Action executed when a state is entered, may be nullptr */
+    static const Action enterActions[NUM_STATES];
+
+    DeviceClass deviceClass = CLASS_A;
+    State state = IDLE;
+    int windowPhase = PHASE_DONE;
 
     /** Remaining backoff period in seconds */
     simtime_t backoffPeriod = -1;
@@ -91,38 +181,50 @@ class LoRaMac : public MacProtocolBase, public IMacProtocol, public queueing::IA
     /** Number of frame retransmission attempts. */
     int retryCounter = -1;
 
-    /** Messages received from upper layer and to be transmitted later */
-    cPacketQueue transmissionQueue;
-
-    /** Passive queue module to request messages from */
-    cPacketQueue *queueModule = nullptr;
+    /** @name Over-the-air activation state */
+    //@{
+    /** The node has a network session and may send data frames */
+    bool joined = true;
+    /** A join request is to be sent as soon as the MAC is idle */
+    bool joinPending = false;
+    /** Start of the ongoing join procedure, -1 when not joining */
+    simtime_t joinStartTime = -1;
+    int devNonce = 0;
     //@}
 
-    /** @name Timer messages */
-    //@{
-    /** Timeout after the transmission of a Data frame */
-    cMessage *endTransmission = nullptr;
+    /** Number of times the current transmission was deferred by listen-before-talk */
+    int cadDeferrals = 0;
+
+    /** Start of the first transmission attempt of the current frame */
+    simtime_t firstAttemptTime = -1;
 
-    /** Timeout after the reception of a Data frame */
-    cMessage *endReception = nullptr;
+    /** Start of the last transmission, used to compute its airtime */
+    simtime_t lastTransmissionStart = -1;
 
-    /** Timeout after the reception of a Data frame */
-    cMessage *droppedPacket = nullptr;
+    /** Earliest retransmission start allowed by the duty cycle */
+    simtime_t dutyCycleEndTime = 0;
 
-    /** End of the Delay_1 */
-    cMessage *endDelay_1 = nullptr;
+    /** Reception time of the last Class B beacon */
+    simtime_t lastBeaconTime = -1;
 
-    /** End of the Listening_1 */
-    cMessage *endListening_1 = nullptr;
+    /** Uplink CF/SF/BW of the radio while it is tuned to the beacon channel, SF -1 otherwise */
+    Hz uplinkCF = Hz(NaN);
+    int uplinkSF = -1;
+    Hz uplinkBW = Hz(NaN);
 
-    /** End of the Delay_2 */
-    cMessage *endDelay_2 = nullptr;
+    /** Messages received from upper layer and to be transmitted later */
+    cPacketQueue transmissionQueue;
 
-    /** End of the Listening_2 */
-    cMessage *endListening_2 = nullptr;
+    /** Passive queue module to request messages from */
+    cPacketQueue *queueModule = nullptr;
+    //@}
 
-    /** Radio state change self message. Currently this is optimized away and sent directly */
-    cMessage *mediumStateChange = nullptr;
+    /** @name Timer messages */
+    //@{
+    /** The only timer of the MAC; its kind is the phase that ends when it fires */
+    cMessage *windowTimer = nullptr;
+    /** Start of the (re)join procedure, e.g. when power returns after an outage */
+    cMessage *joinTimer = nullptr;
     //@}
 
     /** @name Statistics */
@@ -135,6 +237,23 @@ class LoRaMac : public MacProtocolBase, public IMacProtocol, public queueing::IA
     long numReceived;
     long numSentBroadcast;
     long numReceivedBroadcast;
+    long numConfirmed;
+    long numAcked;
+    cStdDev attemptsPerDelivery;
+    cStdDev deliveryLatency;
+    long numBeaconsReceived;
+    long numSlotsOpened;
+    long numPingSlotDownlinks;
+    long numCadBusy;
+    long numCadDeferralsExhausted;
+    long numJoinRequests;
+    cStdDev joinLatency;
+
+    static simsignal_t joinStartedSignal;
+    static simsignal_t joinCompletedSignal;
+
+    /** Energy consumer of the radio, used for the energy per delivered packet */
+    LoRaEnergyConsumer *energyConsumer = nullptr;
     //@}
 
   public:
@@ -149,6 +268,11 @@ class LoRaMac : public MacProtocolBase, public IMacProtocol, public queueing::IA
     virtual void handleCanPullPacketChanged(cGate *gate) override;
     virtual void handlePullPacketProcessed(Packet *packet, cGate *gate, bool successful) override;
 
+    /** Called by the LoRaClassBScheduler at the start and end of a beacon window or ping slot */
+    virtual void handleClassBWakeup(bool open, bool beaconWindow);
+    virtual bool isBeaconLocked();
+    int getPingSlotPeriodicity() const { return pingSlotPeriodicity; }
+
   protected:
     /**
      * @name Initialization functions
@@ -168,7 +292,7 @@ class LoRaMac : public MacProtocolBase, public IMacProtocol, public queueing::IA
     virtual void handleSelfMessage(cMessage *msg) override;
     virtual void handleUpperPacket(Packet *packet) override;
     virtual void handleLowerPacket(Packet *packet) override;
-    virtual void handleWithFsm(cMessage *msg);
+    virtual void handleWithFsm(Event event, Packet *packet = nullptr);
 
     virtual void receiveSignal(cComponent *source, simsignal_t signalID, intval_t value, cObject *details) override;
 
@@ -195,6 +319,20 @@ class LoRaMac : public MacProtocolBase, public IMacProtocol, public queueing::IA
      */
     //@{
     virtual void finishCurrentTransmission();
+    virtual void scheduleWindowTimer();
+    virtual State resolveWindowState();
+    virtual State resolveTransmitState();
+    virtual bool isChannelBusy();
+    virtual bool isIdle();
+    virtual void handleAck();
+    virtual void startJoin();
+    virtual void prepareJoinRequest();
+    virtual void handleJoinAccept();
+    virtual bool isJoining();
+    virtual double getJoinDutyCycle();
+    virtual void enterState(State newState);
+    virtual void prepareUpperPacket(Packet *packet);
+    static const char *getStateName(State state);
     virtual Packet *getCurrentTransmission();
 
     virtual bool isReceiving();
@@ -204,6 +342,12 @@ class LoRaMac : public MacProtocolBase, public IMacProtocol, public queueing::IA
 
     void turnOnReceiver(void);
     void turnOffReceiver(void);
+    void tuneToBeacon(void);
+    void restoreUplinkTuning(void);
+    void sendCurrentTransmission(void);
+    void scheduleRetransmission(void);
+    void scheduleCadBackoff(void);
+    bool isWaitingForAck();
     virtual void processUpperPacket();
     //@}
 };
@@ -149,7 +149,10 @@ void LoRaRadio::handleTransmissionTimer(cMessage *message)
 
 void LoRaRadio::handleReceptionTimer(cMessage *message)
 {
-    if (message->getKind() == IRadioSignal::SIGNAL_PART_WHOLE)
+    if (message->getKind() == PENDING_ARRIVAL_KIND)
+        // arrival delivered ahead of its start time by the medium
+        startReception(message, separateReceptionParts ? IRadioSignal::SIGNAL_PART_PREAMBLE : IRadioSignal::SIGNAL_PART_WHOLE);
+    else if (message->getKind() == IRadioSignal::SIGNAL_PART_WHOLE)
         endReception(message);
     else if (message->getKind() == IRadioSignal::SIGNAL_PART_PREAMBLE)
         continueReception(message);
@@ -221,6 +224,32 @@ void LoRaRadio::handleSignal(WirelessSignal *radioFrame)
         startReception(receptionTimer, IRadioSignal::SIGNAL_PART_WHOLE);
 }
 
+void LoRaRadio::handleArrival(const ITransmission *transmission)
+{
+    Enter_Method_Silent();
+    // a sleeping or transmitting end node would only schedule a timer to ignore the signal,
+    // and so would a filtering node for frames addressed to someone else
+    if (!isReceiverMode(radioMode) || !isAddressedToMe(transmission))
+        return;
+    auto radioFrame = check_and_cast<LoRaMedium *>(medium.get())->createArrivalSignal(this, transmission);
+    if (radioFrame->getArrival()->getStartTime() == simTime())
+        handleSignal(radioFrame);
+    else {
+        auto timer = createReceptionTimer(radioFrame);
+        timer->setKind(PENDING_ARRIVAL_KIND);
+        scheduleAt(radioFrame->getArrival()->getStartTime(), timer);
+    }
+}
+
+bool LoRaRadio::isAddressedToMe(const ITransmission *transmission) const
+{
+    if (receiverAddressFilter.isUnspecified())
+        return true;
+    // the preamble is inspected without computing the reception
+    const auto& preamble = transmission->getPacket()->peekAtFront<LoRaPhyPreamble>();
+    return preamble->getReceiverAddress() == receiverAddressFilter;
+}
+
 /*
 bool LoRaRadio::handleNodeStart(IDoneCallback *doneCallback)
 {
@@ -410,12 +439,14 @@ void LoRaRadio::endReception(cMessage *timer)
         auto transmission = signal->getTransmission();
         // TODO: this would draw twice from the random number generator in isReceptionSuccessful: auto isReceptionSuccessful = medium->isReceptionSuccessful(this, transmission, part);
         auto isReceptionSuccessful = medium->getReceptionDecision(this, signal->getListening(), transmission, part)->isReceptionSuccessful();
-        EV_INFO << "Reception ended: " << (isReceptionSuccessful ? "\x1b[1msuccessfully\x1b[0m" : "\x1b[1munsuccessfully\x1b[0m") << " for " << (IWirelessSignal *)signal << " " << IRadioSignal::getSignalPartName(part) << " as " << reception << endl;
+        EV_DETAIL << "Reception ended: " << (isReceptionSuccessful ? "\x1b[1msuccessfully\x1b[0m" : "\x1b[1munsuccessfully\x1b[0m") << " for " << (IWirelessSignal *)signal << " " << IRadioSignal::getSignalPartName(part) << " as " << reception << endl;
         auto macFrame = medium->receivePacket(this, signal);
         take(macFrame);
         decapsulate(macFrame);
-        if (isReceptionSuccessful)
+        if (isReceptionSuccessful) {
+            check_and_cast<const LoRaReceiver *>(receiver)->addErrorRateInd(macFrame, medium->getSNIR(this, transmission));
             sendUp(macFrame);
+        }
         else {
             emit(LoRaRadio::droppedPacket, 0);
             delete macFrame;
@@ -424,7 +455,7 @@ void LoRaRadio::endReception(cMessage *timer)
         emit(receptionEndedSignal, check_and_cast<const cObject *>(reception));
     }
     else
-        EV_INFO << "Reception ended: \x1b[1mignoring\x1b[0m " << (IWirelessSignal *)signal << " " << IRadioSignal::getSignalPartName(part) << " as " << reception << endl;
+        EV_DETAIL << "Reception ended: \x1b[1mignoring\x1b[0m " << (IWirelessSignal *)signal << " " << IRadioSignal::getSignalPartName(part) << " as " << reception << endl;
     updateTransceiverState();
     updateTransceiverPart();
     delete timer;
@@ -512,7 +543,7 @@ void LoRaRadio::sendUp(Packet *macFrame)
         emit(bitErrorRateSignal, errorTag->getBitErrorRate());
     if (errorTag && !std::isnan(errorTag->getSymbolErrorRate()))
         emit(symbolErrorRateSignal, errorTag->getSymbolErrorRate());
-    EV_INFO << "Sending up " << macFrame << endl;
+    EV_DETAIL << "Sending up " << macFrame << endl;
     NarrowbandRadioBase::sendUp(macFrame);
     //send(macFrame, upperLayerOut);
 }
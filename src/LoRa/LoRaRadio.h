@@ -23,13 +23,15 @@
 #include "inet/physicallayer/wireless/common/contract/packetlevel/IRadioMedium.h"
 //#include "inet/physicallayer/wireless/common/base/packetlevel/FlatRadioBase.h"
 #include "inet/physicallayer/wireless/common/base/packetlevel/NarrowbandRadioBase.h"
+#include "inet/linklayer/common/MacAddress.h"
+#include "LoRaPhy/ILoRaArrivalHandler.h"
 
 using namespace inet;
 using namespace inet::physicallayer;
 
 namespace flora {
 
-class LoRaRadio : public NarrowbandRadioBase //: public PhysicalLayerBase, public virtual IRadio
+class LoRaRadio : public NarrowbandRadioBase, public ILoRaArrivalHandler //: public PhysicalLayerBase, public virtual IRadio
 {
 public:
   static simsignal_t minSNIRSignal;
@@ -53,6 +55,9 @@ public:
   bool loRaUseHeader;
 
 private:
+  /** When specified, only arrivals whose preamble carries this receiver address are received */
+  MacAddress receiverAddressFilter;
+
   void parseRadioModeSwitchingTimes();
   void startRadioModeSwitch(RadioMode newRadioMode, simtime_t switchingTime);
 
@@ -126,6 +131,11 @@ public:
   virtual IRadioSignal::SignalPart getReceivedSignalPart() const override;
 
   virtual void decapsulate(Packet *packet) const override;
+
+  virtual void handleArrival(const ITransmission *transmission) override;
+
+  void setReceiverAddressFilter(const MacAddress& address) { receiverAddressFilter = address; }
+  bool isAddressedToMe(const ITransmission *transmission) const;
 };
 
 } // namespace inet
@@ -0,0 +1,172 @@
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+// 
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see http://www.gnu.org/licenses/.
+// 
+
+#include <algorithm>
+
+#include "LoRaSFAssigner.h"
+#include "LoRaRadio.h"
+#include "LoRaGWRadio.h"
+#include "LoRaPhy/ILoRaMeanPathLoss.h"
+#include "LoRaPhy/LoRaMedium.h"
+#include "LoRaPhy/LoRaReceiver.h"
+#include "inet/common/ModuleAccess.h"
+
+namespace flora {
+
+Define_Module(LoRaSFAssigner);
+
+void LoRaSFAssigner::initialize()
+{
+    medium = getModuleFromPar<LoRaMedium>(par("radioMediumModule"), this);
+    policy = par("policy").stdstringValue();
+    margin = par("margin");
+    minPower = par("minPower");
+    maxPower = par("maxPower");
+    powerStep = par("powerStep");
+    ringWidth = m(par("ringWidth"));
+}
+
+void LoRaSFAssigner::handleMessage(cMessage *msg)
+{
+    throw cRuntimeError("This module does not handle messages");
+}
+
+void LoRaSFAssigner::getAssignment(const LoRaRadio *radio, int& spreadFactor, double& power)
+{
+    Enter_Method_Silent("getAssignment");
+    // the apps ask in their application layer init stage, when every node is placed
+    if (!assigned) {
+        carrierFrequency = radio->loRaCF;
+        bandwidth = radio->loRaBW;
+        assignAll();
+    }
+    auto it = assignments.find(radio);
+    if (it == assignments.end())
+        return;
+    spreadFactor = it->second.spreadFactor;
+    power = it->second.power;
+}
+
+std::vector<LoRaSFAssigner::Link> LoRaSFAssigner::computeLinks()
+{
+    std::vector<const LoRaRadio *> nodes;
+    std::vector<Coord> gateways;
+    for (cModule::SubmoduleIterator it(getSimulation()->getSystemModule()); !it.end(); ++it) {
+        for (cModule::SubmoduleIterator nic(*it); !nic.end(); ++nic) {
+            cModule *radio = (*nic)->getSubmodule("radio");
+            if (auto gwRadio = dynamic_cast<LoRaGWRadio *>(radio))
+                gateways.push_back(gwRadio->getAntenna()->getMobility()->getCurrentPosition());
+            else if (auto nodeRadio = dynamic_cast<LoRaRadio *>(radio))
+                nodes.push_back(nodeRadio);
+        }
+    }
+    if (gateways.empty())
+        throw cRuntimeError("No gateways to compute the link budgets to");
+    std::vector<Link> links;
+    mps propagationSpeed = medium->getPropagation()->getPropagationSpeed();
+    // the mean path loss, so that the assignment neither depends on nor
+    // consumes the shadowing draws of the actual receptions
+    const IPathLoss *pathLoss = medium->getPathLoss();
+    auto meanPathLoss = dynamic_cast<const ILoRaMeanPathLoss *>(pathLoss);
+    for (auto radio : nodes) {
+        Coord position = radio->getAntenna()->getMobility()->getCurrentPosition();
+        Link link = { radio, -INFINITY, m(INFINITY) };
+        for (const auto& gateway : gateways) {
+            m distance = m(position.distance(gateway));
+            double gain = math::fraction2dB(meanPathLoss != nullptr ? meanPathLoss->computeMeanPathLoss(propagationSpeed, carrierFrequency, distance)
+                    : pathLoss->computePathLoss(propagationSpeed, carrierFrequency, distance));
+            link.gain = std::max(link.gain, gain);
+            link.distance = std::min(link.distance, distance);
+        }
+        links.push_back(link);
+    }
+    return links;
+}
+
+bool LoRaSFAssigner::isFeasible(const Link& link, int spreadFactor, double power) const
+{
+    W sensitivity = LoRaReceiver::getSensitivity(spreadFactor, bandwidth);
+    return power + link.gain >= math::mW2dBmW(sensitivity.get() * 1000) + margin;
+}
+
+int LoRaSFAssigner::getLowestFeasibleSF(const Link& link) const
+{
+    int spreadFactor = minSF;
+    while (spreadFactor <= maxSF && !isFeasible(link, spreadFactor, maxPower))
+        spreadFactor++;
+    return spreadFactor;
+}
+
+double LoRaSFAssigner::getLowestFeasiblePower(const Link& link, int spreadFactor) const
+{
+    double power = maxPower;
+    while (power - powerStep >= minPower && isFeasible(link, spreadFactor, power - powerStep))
+        power -= powerStep;
+    return power;
+}
+
+void LoRaSFAssigner::assignAll()
+{
+    assigned = true;
+    std::vector<Link> links = computeLinks();
+    if (policy == "minSF") {
+        for (const auto& link : links) {
+            Assignment& assignment = assignments[link.radio];
+            assignment.spreadFactor = std::min(getLowestFeasibleSF(link), maxSF);
+            assignment.power = getLowestFeasiblePower(link, assignment.spreadFactor);
+        }
+    }
+    else if (policy == "equalAirtime") {
+        // the airtime doubles with each SF, so SF k gets a share of the nodes
+        // proportional to 2^-(k-7) and every SF carries the same airtime;
+        // the best links fill the fast SFs, and no node gets an SF its link
+        // cannot close
+        std::sort(links.begin(), links.end(), [] (const Link& a, const Link& b) { return a.gain > b.gain; });
+        double totalShare = 0;
+        for (int sf = minSF; sf <= maxSF; sf++)
+            totalShare += std::ldexp(1, minSF - sf);
+        size_t next = 0;
+        double cumulativeShare = 0;
+        for (int sf = minSF; sf <= maxSF; sf++) {
+            cumulativeShare += std::ldexp(1, minSF - sf) / totalShare;
+            size_t end = sf == maxSF ? links.size() : (size_t)std::round(cumulativeShare * links.size());
+            for (; next < end; next++) {
+                Assignment& assignment = assignments[links[next].radio];
+                assignment.spreadFactor = std::min(std::max(sf, getLowestFeasibleSF(links[next])), maxSF);
+                assignment.power = getLowestFeasiblePower(links[next], assignment.spreadFactor);
+            }
+        }
+    }
+    else if (policy == "distanceRing") {
+        for (const auto& link : links) {
+            Assignment& assignment = assignments[link.radio];
+            assignment.spreadFactor = std::min(minSF + (int)std::floor(unit(link.distance / ringWidth).get()), maxSF);
+            assignment.power = maxPower;
+        }
+    }
+    else
+        throw cRuntimeError("Unknown SF assignment policy '%s'", policy.c_str());
+}
+
+void LoRaSFAssigner::finish()
+{
+    int numNodes[maxSF - minSF + 1] = {};
+    for (const auto& it : assignments)
+        numNodes[it.second.spreadFactor - minSF]++;
+    for (int sf = minSF; sf <= maxSF; sf++)
+        recordScalar(("numNodesAssigned SF" + std::to_string(sf)).c_str(), numNodes[sf - minSF]);
+}
+
+} // namespace flora
@@ -0,0 +1,90 @@
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+// 
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see http://www.gnu.org/licenses/.
+// 
+
+#ifndef LORA_LORASFASSIGNER_H_
+#define LORA_LORASFASSIGNER_H_
+
+#include <map>
+#include <vector>
+
+#include "inet/common/INETDefs.h"
+#include "inet/common/Units.h"
+
+namespace flora {
+
+using namespace inet;
+using namespace inet::units::values;
+
+class LoRaRadio;
+class LoRaMedium;
+
+/**
+ * Initial SF and TP of the end nodes from their link budget to the gateways.
+ * See LoRaSFAssigner.ned.
+ */
+class LoRaSFAssigner : public cSimpleModule
+{
+  protected:
+    struct Assignment
+    {
+        int spreadFactor = 12;
+        double power = 14;       // dBm
+    };
+
+    /** End node with the best path gain to any gateway */
+    struct Link
+    {
+        const LoRaRadio *radio;
+        double gain;             // dB, negative
+        m distance;              // to the nearest gateway
+    };
+
+    static const int minSF = 7;
+    static const int maxSF = 12;
+
+    LoRaMedium *medium = nullptr;
+    std::string policy;
+    double margin = NaN;
+    double minPower = NaN;
+    double maxPower = NaN;
+    double powerStep = NaN;
+    m ringWidth = m(NaN);
+    /** Channel of the first node asking, the nodes share the channel plan */
+    Hz carrierFrequency = Hz(NaN);
+    Hz bandwidth = Hz(NaN);
+    bool assigned = false;
+    std::map<const LoRaRadio *, Assignment> assignments;
+
+  protected:
+    virtual void initialize() override;
+    virtual void handleMessage(cMessage *msg) override;
+    virtual void finish() override;
+
+    virtual void assignAll();
+    virtual std::vector<Link> computeLinks();
+    /** Lowest SF whose sensitivity plus margin is reached at maxPower, maxSF + 1 if none */
+    virtual int getLowestFeasibleSF(const Link& link) const;
+    /** Lowest power in powerStep steps below maxPower that still closes the link at the given SF */
+    virtual double getLowestFeasiblePower(const Link& link, int spreadFactor) const;
+    virtual bool isFeasible(const Link& link, int spreadFactor, double power) const;
+
+  public:
+    /** Overwrites the initial SF and TP (in dBm) of the node with its assignment */
+    virtual void getAssignment(const LoRaRadio *radio, int& spreadFactor, double& power);
+};
+
+} // namespace flora
+
+#endif /* LORA_LORASFASSIGNER_H_ */
@@ -0,0 +1,52 @@
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+// 
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see http://www.gnu.org/licenses/.
+// 
+
+#include <algorithm>
+
+#include "LoRaServerRing.h"
+
+namespace flora {
+
+void LoRaServerRing::build(int numServers, int virtualNodesPerServer)
+{
+    points.clear();
+    for (int server = 0; server < numServers; server++)
+        for (int i = 0; i < virtualNodesPerServer; i++)
+            points[hash(((uint64_t)server << 32) | i)] = server;
+}
+
+std::vector<int> LoRaServerRing::getServers(const MacAddress& address, int count) const
+{
+    std::vector<int> servers;
+    auto it = points.lower_bound(hash(address.getInt()));
+    // walk clockwise until enough distinct servers are found
+    for (size_t steps = 0; steps < points.size() && (int)servers.size() < count; steps++, it++) {
+        if (it == points.end())
+            it = points.begin();
+        if (std::find(servers.begin(), servers.end(), it->second) == servers.end())
+            servers.push_back(it->second);
+    }
+    return servers;
+}
+
+int LoRaServerRing::getPrimaryServer(const MacAddress& address) const
+{
+    if (points.empty())
+        return -1;
+    auto it = points.lower_bound(hash(address.getInt()));
+    return it != points.end() ? it->second : points.begin()->second;
+}
+
+} // namespace flora
@@ -0,0 +1,59 @@
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+// 
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see http://www.gnu.org/licenses/.
+// 
+
+#ifndef LORA_LORASERVERRING_H_
+#define LORA_LORASERVERRING_H_
+
+#include <map>
+#include <vector>
+
+#include "inet/common/INETDefs.h"
+#include "inet/linklayer/common/MacAddress.h"
+
+namespace flora {
+
+using namespace inet;
+
+/**
+ * Consistent hash ring over the network servers a gateway forwards to.
+ * Every packet forwarder and network server builds the same ring from the
+ * number of servers, so all of them agree on the servers of a node.
+ */
+class LoRaServerRing
+{
+  protected:
+    /** Point on the ring -> index of the network server */
+    std::map<uint64_t, int> points;
+
+  public:
+    void build(int numServers, int virtualNodesPerServer);
+    bool isEmpty() const { return points.empty(); }
+    /** Up to count distinct network servers of a node, its primary one first */
+    std::vector<int> getServers(const MacAddress& address, int count) const;
+    int getPrimaryServer(const MacAddress& address) const;
+
+    /** splitmix64 finalizer, spreads consecutive inputs over the 64-bit range */
+    static uint64_t hash(uint64_t value)
+    {
+        value += 0x9e3779b97f4a7c15ULL;
+        value = (value ^ (value >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        value = (value ^ (value >> 27)) * 0x94d049bb133111ebULL;
+        return value ^ (value >> 31);
+    }
+};
+
+} // namespace flora
+
+#endif /* LORA_LORASERVERRING_H_ */
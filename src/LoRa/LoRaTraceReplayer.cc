@@ -0,0 +1,157 @@
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+// 
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see http://www.gnu.org/licenses/.
+// 
+
+#include "LoRaTraceReplayer.h"
+#include "LoRaMacFrame_m.h"
+#include "../LoRaApp/LoRaAppPacket_m.h"
+#include "inet/networklayer/common/L3AddressTag_m.h"
+#include "inet/networklayer/common/ModuleIdAddress.h"
+
+namespace flora {
+
+Define_Module(LoRaTraceReplayer);
+
+LoRaTraceReplayer::~LoRaTraceReplayer()
+{
+    cancelAndDelete(replayTimer);
+}
+
+void LoRaTraceReplayer::initialize()
+{
+    LoRaBackhaul::initialize();
+    server = getModuleByPath(par("serverModule"));
+    const char *fileName = par("traceFile");
+    trace.open(fileName, std::ios::in | std::ios::binary);
+    if (!trace.is_open())
+        throw cRuntimeError("Cannot open frame trace file '%s'", fileName);
+    char magic[4];
+    uint16_t version;
+    trace.read(magic, 4);
+    trace.read(reinterpret_cast<char *>(&version), sizeof(version));
+    trace.read(reinterpret_cast<char *>(&recordSize), sizeof(recordSize));
+    if (!trace || strncmp(magic, "LFTR", 4) != 0)
+        throw cRuntimeError("'%s' is not a frame trace", fileName);
+    if (version < 2)
+        throw cRuntimeError("Frame trace '%s' has version %d, replay needs version 2 or later", fileName, version);
+    buffer.resize(recordSize);
+    replayTimer = new cMessage("replay");
+    if (readNextRecord())
+        scheduleAt(next.time, replayTimer);
+}
+
+void LoRaTraceReplayer::handleMessage(cMessage *msg)
+{
+    if (msg != replayTimer) {
+        LoRaBackhaul::handleMessage(msg);
+        return;
+    }
+    // uplinks forwarded at the same time are delivered by the same event
+    do {
+        Packet *packet = createUplink(next);
+        numUplinksReplayed++;
+        sendDirect(packet, server, "backhaulIn");
+    } while (readNextRecord() && next.time <= simTime().dbl());
+    if (trace)
+        scheduleAt(next.time, replayTimer);
+}
+
+bool LoRaTraceReplayer::readNextRecord()
+{
+    while (trace.read(buffer.data(), recordSize)) {
+        if (strncmp(buffer.data(), "LFTM", 4) == 0)
+            break;   // module table at the end
+        const char *data = buffer.data();
+        auto field = [&data] (auto& value) {
+            memcpy(&value, data, sizeof(value));
+            data += sizeof(value);
+        };
+        uint8_t type, outcome;
+        int8_t spreadFactor;
+        int32_t gatewayId, sequenceNumber;
+        field(next.time);
+        field(type);
+        field(outcome);
+        field(spreadFactor);
+        field(next.flags);
+        field(gatewayId);
+        field(next.nodeAddress);
+        field(sequenceNumber);
+        field(next.rssi);
+        field(next.snir);
+        field(next.txPower);
+        if (type != LoRaFrameEvent::GW_FORWARDED)
+            continue;
+        next.spreadFactor = spreadFactor;
+        next.gatewayId = gatewayId;
+        next.sequenceNumber = sequenceNumber;
+        return true;
+    }
+    trace.setstate(std::ios::eofbit | std::ios::failbit);
+    return false;
+}
+
+Packet *LoRaTraceReplayer::createUplink(const Record& record)
+{
+    auto frame = makeShared<LoRaMacFrame>();
+    frame->setChunkLength(B(par("headerLength").intValue()));
+    frame->setTransmitterAddress(MacAddress(record.nodeAddress));
+    frame->setReceiverAddress(MacAddress::BROADCAST_ADDRESS);
+    frame->setSequenceNumber(record.sequenceNumber);
+    frame->setConfirmed(record.flags & LoRaFrameEvent::FLAG_CONFIRMED);
+    frame->setJoinRequest(record.flags & LoRaFrameEvent::FLAG_JOIN_REQUEST);
+    frame->setLoRaSF(record.spreadFactor);
+    frame->setLoRaTP(math::dBmW2mW(record.txPower) / 1000);
+    frame->setRSSI(record.rssi);
+    frame->setSNIR(math::dB2fraction(record.snir));
+    frame->setRxTime(simTime());
+    auto packet = new Packet("replayedUplink");
+    if (!frame->getJoinRequest()) {
+        // the network server reads the ADRACKReq bit from the payload
+        auto payload = makeShared<LoRaAppPacket>();
+        payload->setChunkLength(B(par("payloadLength").intValue()));
+        payload->setMsgType(DATA);
+        LoRaOptions options;
+        options.setADRACKReq(record.flags & LoRaFrameEvent::FLAG_ADR_ACK_REQ);
+        payload->setOptions(options);
+        packet->insertAtFront(payload);
+    }
+    packet->insertAtFront(frame);
+    // the recorded packet forwarder stands for the gateway
+    packet->addTag<L3AddressInd>()->setSrcAddress(L3Address(ModuleIdAddress(record.gatewayId)));
+    return packet;
+}
+
+void LoRaTraceReplayer::sendDownlink(Packet *packet, const L3Address& gateway)
+{
+    Enter_Method("sendDownlink");
+    const auto& frame = packet->peekAtFront<LoRaMacFrame>();
+    if (frame->getJoinAccept())
+        numJoinAccepts++;
+    else if (packet->getDataLength() > frame->getChunkLength())
+        numAdrCommands++;
+    else
+        numAcks++;
+    delete packet;
+}
+
+void LoRaTraceReplayer::finish()
+{
+    recordScalar("numUplinksReplayed", numUplinksReplayed);
+    recordScalar("numAcks", numAcks);
+    recordScalar("numAdrCommands", numAdrCommands);
+    recordScalar("numJoinAccepts", numJoinAccepts);
+}
+
+} // namespace flora
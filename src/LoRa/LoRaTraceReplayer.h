@@ -0,0 +1,77 @@
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+// 
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see http://www.gnu.org/licenses/.
+// 
+
+#ifndef LORA_LORATRACEREPLAYER_H_
+#define LORA_LORATRACEREPLAYER_H_
+
+#include <fstream>
+
+#include "LoRaBackhaul.h"
+#include "LoRaFrameEvent.h"
+
+namespace flora {
+
+/**
+ * Replays the forwarded uplinks of a LoRaFrameTrace into network servers.
+ * See LoRaTraceReplayer.ned.
+ */
+class LoRaTraceReplayer : public LoRaBackhaul
+{
+  protected:
+    /** Forwarded uplink read from the trace */
+    struct Record
+    {
+        double time;
+        uint8_t flags;
+        int spreadFactor;
+        int gatewayId;
+        uint64_t nodeAddress;
+        int sequenceNumber;
+        float rssi;
+        float snir;
+        float txPower;
+    };
+
+    std::ifstream trace;
+    uint16_t recordSize = 0;
+    std::vector<char> buffer;
+    Record next;
+    cMessage *replayTimer = nullptr;
+    cModule *server = nullptr;
+
+    long numUplinksReplayed = 0;
+    long numAcks = 0;
+    long numAdrCommands = 0;
+    long numJoinAccepts = 0;
+
+  protected:
+    virtual void initialize() override;
+    virtual void handleMessage(cMessage *msg) override;
+    virtual void finish() override;
+
+    /** Reads the next forwarded uplink, false at the end of the trace */
+    virtual bool readNextRecord();
+    virtual Packet *createUplink(const Record& record);
+
+  public:
+    virtual ~LoRaTraceReplayer();
+
+    /** Downlinks of the network servers end here, they are only counted */
+    virtual void sendDownlink(Packet *packet, const L3Address& gateway) override;
+};
+
+} // namespace flora
+
+#endif /* LORA_LORATRACEREPLAYER_H_ */
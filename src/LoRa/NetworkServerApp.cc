@@ -22,6 +22,7 @@
 #include "inet/networklayer/common/L3AddressResolver.h"
 #include "inet/common/ModuleAccess.h"
 #include "inet/applications/base/ApplicationPacket_m.h"
+#include "LoRaMac.h"
 
 #include "inet/networklayer/common/L3Tools.h"
 #include "inet/networklayer/ipv4/Ipv4Header_m.h"
@@ -30,6 +31,10 @@ namespace flora {
 
 Define_Module(NetworkServerApp);
 
+NetworkServerApp::~NetworkServerApp()
+{
+    cancelAndDelete(pingSlotDownlinkTimer);
+}
 
 void NetworkServerApp::initialize(int stage)
 {
@@ -39,9 +44,37 @@ void NetworkServerApp::initialize(int stage)
         localPort = par("localPort");
         destPort = par("destPort");
         adrMethod = par("adrMethod").stdstringValue();
+        if (*par("backhaulModule").stringValue())
+            backhaul = getModuleFromPar<LoRaBackhaul>(par("backhaulModule"), this);
+        if (*par("classBSchedulerModule").stringValue()) {
+            classBScheduler = getModuleFromPar<LoRaClassBScheduler>(par("classBSchedulerModule"), this);
+            pingSlotLeadTime = par("pingSlotLeadTime");
+            pingSlotDownlinkTimer = new cMessage("pingSlotDownlink");
+            scheduleAt(simTime() + par("pingSlotDownlinkInterval"), pingSlotDownlinkTimer);
+        }
     } else if (stage == INITSTAGE_APPLICATION_LAYER) {
-        startUDP();
+        if (backhaul == nullptr)
+            startUDP();
         getSimulation()->getSystemModule()->subscribe("LoRa_AppPacketSent", this);
+        getSimulation()->getSystemModule()->subscribe("LoRa_JoinStarted", this);
+        getSimulation()->getSystemModule()->subscribe("LoRa_JoinCompleted", this);
+        getSimulation()->getSystemModule()->subscribe("LoRa_DownlinkRejected", this);
+        receiveDelay1 = par("receiveDelay1");
+        receiveDelay2 = par("receiveDelay2");
+        receiveWindowLength = par("receiveWindowLength");
+        deduplicationWindow = par("deduplicationWindow");
+        gatewayBackoffTime = par("gatewayBackoffTime");
+        downlinkGatewayPolicy = par("downlinkGatewayPolicy").stdstringValue();
+        shardIndex = par("shardIndex");
+        if (shardIndex >= 0) {
+            int numShards = par("numShards");
+            if (shardIndex >= numShards)
+                throw cRuntimeError("shardIndex %d is out of range for %d shards", shardIndex, numShards);
+            shardRing.build(numShards, par("virtualNodesPerServer"));
+        }
+        gatewayLoadWindow = par("gatewayLoadWindow");
+        downlinkSNIRMargin = par("downlinkSNIRMargin");
+        networkRecoveryTime.setName("timeToNetworkRecovery");
         evaluateADRinServer = par("evaluateADRinServer");
         adrDeviceMargin = par("adrDeviceMargin");
         receivedRSSI.setName("Received RSSI");
@@ -65,7 +98,7 @@ void NetworkServerApp::startUDP()
 
 void NetworkServerApp::handleMessage(cMessage *msg)
 {
-    if (msg->arrivedOn("socketIn")) {
+    if (msg->arrivedOn("socketIn") || msg->arrivedOn("backhaulIn")) {
         auto pkt = check_and_cast<Packet *>(msg);
         const auto &frame  = pkt->peekAtFront<LoRaMacFrame>();
         if (frame == nullptr)
@@ -78,6 +111,8 @@ void NetworkServerApp::handleMessage(cMessage *msg)
         updateKnownNodes(pkt);
         processLoraMACPacket(pkt);
     }
+    else if (msg == pingSlotDownlinkTimer)
+        sendPingSlotDownlinks();
     else if(msg->isSelfMessage()) {
         processScheduledPacket(msg);
     }
@@ -86,8 +121,10 @@ void NetworkServerApp::handleMessage(cMessage *msg)
 void NetworkServerApp::processLoraMACPacket(Packet *pk)
 {
     const auto & frame = pk->peekAtFront<LoRaMacFrame>();
-    if(isPacketProcessed(frame))
+    // the DevNonce of a join request is not a frame counter
+    if(!frame->getJoinRequest() && isPacketProcessed(frame))
     {
+        emitFrameEvent(frame, LoRaFrameEvent::NS_DUPLICATE);
         delete pk;
         return;
     }
@@ -97,6 +134,7 @@ void NetworkServerApp::processLoraMACPacket(Packet *pk)
 void NetworkServerApp::finish()
 {
     recordScalar("LoRa_NS_DER", double(counterUniqueReceivedPackets)/counterOfSentPacketsFromNodes);
+    recordScalar("numKnownNodes", knownNodes.size());
     for(uint i=0;i<knownNodes.size();i++)
     {
         delete knownNodes[i].historyAllSNIR;
@@ -113,6 +151,21 @@ void NetworkServerApp::finish()
 
     receivedRSSI.recordAs("receivedRSSI");
     recordScalar("totalReceivedPackets", totalReceivedPackets);
+    recordScalar("numAcksSent", numAcksSent);
+    recordScalar("numRetransmissionsReceived", numRetransmissionsReceived);
+    recordScalar("numDownlinksRejectedTooLate", numDownlinksRejectedTooLate);
+    recordScalar("numDownlinksRejectedBusy", numDownlinksRejectedBusy);
+    recordScalar("numDownlinksAvoidingBackedOffGateway", numDownlinksAvoidingBackedOffGateway);
+    if (downlinkGatewayPolicy != "bestSnir")
+        recordScalar("numDownlinksAvoidingBusyGateway", numDownlinksAvoidingBusyGateway);
+    if (classBScheduler != nullptr)
+        recordScalar("numPingSlotDownlinksSent", numPingSlotDownlinksSent);
+    if (numJoinRequestsReceived > 0) {
+        recordScalar("numJoinRequestsReceived", numJoinRequestsReceived);
+        recordScalar("numJoinAcceptsSent", numJoinAcceptsSent);
+        networkRecoveryTime.recordAs("timeToNetworkRecovery", "s");
+        recordScalar("numNodesNotJoined", pendingJoins);
+    }
 
     while(!receivedPackets.empty()) {
         receivedPackets.back().endOfWaiting->removeControlInfo();
@@ -183,7 +236,7 @@ void NetworkServerApp::updateKnownNodes(Packet* pkt)
     {
         if(elem.srcAddr == frame->getTransmitterAddress()) {
             nodeExist = true;
-            if(elem.lastSeqNoProcessed < frame->getSequenceNumber()) {
+            if(!frame->getJoinRequest() && elem.lastSeqNoProcessed < frame->getSequenceNumber()) {
                 elem.lastSeqNoProcessed = frame->getSequenceNumber();
             }
             break;
@@ -194,7 +247,7 @@ void NetworkServerApp::updateKnownNodes(Packet* pkt)
     {
         knownNode newNode;
         newNode.srcAddr= frame->getTransmitterAddress();
-        newNode.lastSeqNoProcessed = frame->getSequenceNumber();
+        newNode.lastSeqNoProcessed = frame->getJoinRequest() ? -1 : frame->getSequenceNumber();
         newNode.framesFromLastADRCommand = 0;
         newNode.numberOfSentADRPackets = 0;
         newNode.historyAllSNIR = new cOutVector;
@@ -222,9 +275,10 @@ void NetworkServerApp::addPktToProcessingTable(Packet* pkt)
         if(frameAux->getTransmitterAddress() == frame->getTransmitterAddress() && frameAux->getSequenceNumber() == frame->getSequenceNumber())
         {
             packetExists = true;
-            const auto& networkHeader = getNetworkProtocolHeader(pkt);
-            const L3Address& gwAddress = networkHeader->getSourceAddress();
+            const L3Address& gwAddress = pkt->getTag<L3AddressInd>()->getSrcAddress();
             elem.possibleGateways.emplace_back(gwAddress, frame->getSNIR(), frame->getRSSI());
+            recordGatewayUplink(gwAddress);
+            emitFrameEvent(frame, LoRaFrameEvent::NS_DUPLICATE);
             delete pkt;
             break;
         }
@@ -235,21 +289,65 @@ void NetworkServerApp::addPktToProcessingTable(Packet* pkt)
         rcvPkt.rcvdPacket = pkt;
         rcvPkt.endOfWaiting = new cMessage("endOfWaitingWindow");
         rcvPkt.endOfWaiting->setControlInfo(pkt);
-        const auto& networkHeader = getNetworkProtocolHeader(pkt);
-        const L3Address& gwAddress = networkHeader->getSourceAddress();
+        const L3Address& gwAddress = pkt->getTag<L3AddressInd>()->getSrcAddress();
         rcvPkt.possibleGateways.emplace_back(gwAddress, frame->getSNIR(), frame->getRSSI());
-        EV << "Added " << gwAddress << " " << frame->getSNIR() << " " << frame->getRSSI() << endl;
-        scheduleAt(simTime() + 1.2, rcvPkt.endOfWaiting);
+        recordGatewayUplink(gwAddress);
+        EV_DEBUG << "Added " << gwAddress << " " << frame->getSNIR() << " " << frame->getRSSI() << endl;
+        emitFrameEvent(frame, LoRaFrameEvent::NS_FIRST_COPY);
+        scheduleAt(simTime() + deduplicationWindow, rcvPkt.endOfWaiting);
         receivedPackets.push_back(rcvPkt);
     }
 }
 
+void NetworkServerApp::emitFrameEvent(const Ptr<const LoRaMacFrame>& frame, LoRaFrameEvent::Outcome outcome)
+{
+    if (!mayHaveListeners(LoRaFrameEvent::loRaFrameEventSignal))
+        return;
+    LoRaFrameEvent event(LoRaFrameEvent::NS_RX, outcome);
+    event.nodeAddress = frame->getTransmitterAddress();
+    event.sequenceNumber = frame->getSequenceNumber();
+    event.spreadFactor = frame->getLoRaSF();
+    event.power = frame->getRSSI();
+    event.snir = math::fraction2dB(frame->getSNIR());
+    emit(LoRaFrameEvent::loRaFrameEventSignal, &event);
+}
+
 void NetworkServerApp::processScheduledPacket(cMessage* selfMsg)
 {
     auto pkt = check_and_cast<Packet *>(selfMsg->removeControlInfo());
     const auto & frame = pkt->peekAtFront<LoRaMacFrame>();
 
-    if (simTime() >= getSimulation()->getWarmupPeriod())
+    bool joinRequest = frame->getJoinRequest();
+    if (joinRequest) {
+        // a new session starts, frame counters and ADR history are reset
+        numJoinRequestsReceived++;
+        for (auto &elem : knownNodes) {
+            if (elem.srcAddr == frame->getTransmitterAddress()) {
+                elem.lastSeqNoProcessed = -1;
+                elem.lastSeqNoDelivered = -1;
+                elem.framesFromLastADRCommand = 0;
+                elem.adrListSNIR.clear();
+                break;
+            }
+        }
+    }
+
+    // a confirmed uplink that was already delivered is retransmitted when its ACK got lost
+    bool retransmission = false;
+    for (auto &elem : knownNodes) {
+        if (!joinRequest && elem.srcAddr == frame->getTransmitterAddress()) {
+            retransmission = elem.lastSeqNoDelivered >= frame->getSequenceNumber();
+            elem.lastSeqNoDelivered = std::max(elem.lastSeqNoDelivered, frame->getSequenceNumber());
+            break;
+        }
+    }
+    if (retransmission)
+        numRetransmissionsReceived++;
+
+    // replicas keep the state of the node, but leave the answers and the
+    // DER of the node to its primary server
+    bool primary = isPrimaryFor(frame->getTransmitterAddress());
+    if (simTime() >= getSimulation()->getWarmupPeriod() && !retransmission && !joinRequest && primary)
     {
         counterUniqueReceivedPacketsPerSF[frame->getLoRaSF()-7]++;
     }
@@ -264,40 +362,66 @@ void NetworkServerApp::processScheduledPacket(cMessage* selfMsg)
         if(frameAux->getTransmitterAddress() == frame->getTransmitterAddress() && frameAux->getSequenceNumber() == frame->getSequenceNumber())        {
             packetNumber = i;
             nodeNumber = frame->getTransmitterAddress().getInt();
-            if (numReceivedPerNode.count(nodeNumber-1)>0)
+            if (retransmission || joinRequest)
+            {
+                // already counted when first delivered
+            } else if (numReceivedPerNode.count(nodeNumber-1)>0)
             {
                 ++numReceivedPerNode[nodeNumber-1];
             } else {
                 numReceivedPerNode[nodeNumber-1] = 1;
             }
 
+            // ADR works on the best reception, whichever gateway sends the downlink
             for(uint j=0;j<receivedPackets[i].possibleGateways.size();j++)
             {
                 if(SNIRinGW < std::get<1>(receivedPackets[i].possibleGateways[j]))
                 {
                     RSSIinGW = std::get<2>(receivedPackets[i].possibleGateways[j]);
                     SNIRinGW = std::get<1>(receivedPackets[i].possibleGateways[j]);
-                    pickedGateway = std::get<0>(receivedPackets[i].possibleGateways[j]);
                 }
             }
+            pickedGateway = pickDownlinkGateway(receivedPackets[i]);
         }
     }
-    emit(LoRa_ServerPacketReceived, true);
-    if (simTime() >= getSimulation()->getWarmupPeriod())
+    for (auto &elem : knownNodes) {
+        if (elem.srcAddr == frame->getTransmitterAddress()) {
+            elem.lastGateway = pickedGateway;
+            elem.lastCF = frame->getLoRaCF();
+            elem.lastSF = frame->getLoRaSF();
+            elem.lastBW = frame->getLoRaBW();
+            break;
+        }
+    }
+    bool downlinkSent = false;
+    if (joinRequest)
     {
-        counterUniqueReceivedPackets++;
+        if (primary)
+            sendJoinAccept(frame, pickedGateway);
+        downlinkSent = true;
     }
-    receivedRSSI.collect(frame->getRSSI());
-    if(evaluateADRinServer)
+    else if (!retransmission)
     {
-        evaluateADR(pkt, pickedGateway, SNIRinGW, RSSIinGW);
+        emit(LoRa_ServerPacketReceived, true);
+        if (simTime() >= getSimulation()->getWarmupPeriod() && primary)
+        {
+            counterUniqueReceivedPackets++;
+        }
+        receivedRSSI.collect(frame->getRSSI());
+        if(evaluateADRinServer)
+        {
+            downlinkSent = evaluateADR(pkt, pickedGateway, SNIRinGW, RSSIinGW);
+        }
     }
+    // the ACK is piggybacked on an ADR command if one was sent
+    if (frame->getConfirmed() && !downlinkSent && primary)
+        sendAck(frame, pickedGateway);
     delete receivedPackets[packetNumber].rcvdPacket;
     delete selfMsg;
     receivedPackets.erase(receivedPackets.begin()+packetNumber);
 }
 
-void NetworkServerApp::evaluateADR(Packet* pkt, L3Address pickedGateway, double SNIRinGW, double RSSIinGW)
+bool NetworkServerApp::evaluateADR(Packet* pkt, L3Address pickedGateway, double SNIRinGW, double RSSIinGW)
 {
     bool sendADR = false;
     bool sendADRAckRep = false;
@@ -307,12 +431,12 @@ void NetworkServerApp::evaluateADR(Packet* pkt, L3Address pickedGateway, double
     pkt->trimFront();
     auto frame = pkt->removeAtFront<LoRaMacFrame>();
 
-    const auto & rcvAppPacket = pkt->peekAtFront<LoRaAppPacket>();
-
-    if(rcvAppPacket->getOptions().getADRACKReq())
-    {
-        sendADRAckRep = true;
-    }
+    // SimpleLoRaApp and wlam_sensor_app carry the ADRACKReq bit in their payloads
+    const auto & payload = pkt->peekAtFront<Chunk>();
+    if (auto rcvAppPacket = dynamicPtrCast<const LoRaAppPacket>(payload))
+        sendADRAckRep = rcvAppPacket->getOptions().getADRACKReq();
+    else if (auto sensorPacket = dynamicPtrCast<const LoRaSensorPacket>(payload))
+        sendADRAckRep = sensorPacket->getADRACKReq();
 
     for(uint i=0;i<knownNodes.size();i++)
     {
@@ -351,6 +475,9 @@ void NetworkServerApp::evaluateADR(Packet* pkt, L3Address pickedGateway, double
         }
     }
 
+    // a replica counted the frames and reset the counter as the primary did
+    if ((sendADR || sendADRAckRep) && !isPrimaryFor(frame->getTransmitterAddress()))
+        return false;
     if(sendADR || sendADRAckRep)
     {
         auto mgmtPacket = makeShared<LoRaAppPacket>();
@@ -359,13 +486,7 @@ void NetworkServerApp::evaluateADR(Packet* pkt, L3Address pickedGateway, double
         if(sendADR)
         {
             double SNRmargin;
-            double requiredSNR;
-            if(frame->getLoRaSF() == 7) requiredSNR = -7.5;
-            if(frame->getLoRaSF() == 8) requiredSNR = -10;
-            if(frame->getLoRaSF() == 9) requiredSNR = -12.5;
-            if(frame->getLoRaSF() == 10) requiredSNR = -15;
-            if(frame->getLoRaSF() == 11) requiredSNR = -17.5;
-            if(frame->getLoRaSF() == 12) requiredSNR = -20;
+            double requiredSNR = getRequiredSNIR(frame->getLoRaSF());
 
             SNRmargin = SNRm - requiredSNR - adrDeviceMargin;
             knownNodes[nodeIndex].calculatedSNRmargin->record(SNRmargin);
@@ -399,8 +520,8 @@ void NetworkServerApp::evaluateADR(Packet* pkt, L3Address pickedGateway, double
 
             newOptions.setLoRaSF(calculatedSF);
             newOptions.setLoRaTP(calculatedPowerdBm);
-            EV << calculatedSF << endl;
-            EV << calculatedPowerdBm << endl;
+            EV_DEBUG << calculatedSF << endl;
+            EV_DEBUG << calculatedPowerdBm << endl;
             mgmtPacket->setOptions(newOptions);
         }
 
@@ -416,6 +537,9 @@ void NetworkServerApp::evaluateADR(Packet* pkt, L3Address pickedGateway, double
 
         //frameToSend->encapsulate(mgmtPacket);
         frameToSend->setReceiverAddress(frame->getTransmitterAddress());
+        frameToSend->setAck(frame->getConfirmed());
+        frameToSend->setTxTime(frame->getRxTime() + receiveDelay1);
+        frameToSend->setRx2Time(frame->getRxTime() + receiveDelay2);
         //FIXME: What value to set for LoRa TP
         //frameToSend->setLoRaTP(pkt->getLoRaTP());
         frameToSend->setLoRaTP(math::dBmW2mW(14));
@@ -428,14 +552,214 @@ void NetworkServerApp::evaluateADR(Packet* pkt, L3Address pickedGateway, double
 
         pktAux->insertAtFront(mgmtPacket);
         pktAux->insertAtFront(frameToSend);
-        socket.sendTo(pktAux, pickedGateway, destPort);
-
+        sendDownlink(pktAux, pickedGateway);
+        if (frame->getConfirmed())
+            numAcksSent++;
+        return true;
     }
     //delete pkt;
+    return false;
+}
+
+L3Address NetworkServerApp::pickDownlinkGateway(const receivedPacket& packet)
+{
+    const auto& gateways = packet.possibleGateways;
+    auto bySnir = [] (const std::tuple<L3Address, double, double>& a, const std::tuple<L3Address, double, double>& b) {
+        return std::get<1>(a) < std::get<1>(b);
+    };
+    auto best = std::max_element(gateways.begin(), gateways.end(), bySnir);
+    // back-pressure: a gateway that recently rejected a downlink is only used
+    // when no other gateway received the uplink
+    if (isGatewayBackedOff(std::get<0>(*best))) {
+        auto available = gateways.end();
+        for (auto it = gateways.begin(); it != gateways.end(); ++it)
+            if (!isGatewayBackedOff(std::get<0>(*it)) && (available == gateways.end() || bySnir(*available, *it)))
+                available = it;
+        if (available != gateways.end()) {
+            best = available;
+            numDownlinksAvoidingBackedOffGateway++;
+        }
+    }
+    if (downlinkGatewayPolicy == "bestSnir" || gateways.size() == 1)
+        return std::get<0>(*best);
+    if (downlinkGatewayPolicy != "leastBusy")
+        throw cRuntimeError("Unknown downlinkGatewayPolicy '%s'", downlinkGatewayPolicy.c_str());
+
+    // the uplink SNIR stands in for the downlink link budget
+    int spreadFactor = packet.rcvdPacket->peekAtFront<LoRaMacFrame>()->getLoRaSF();
+    double minSNIR = getRequiredSNIR(spreadFactor) + downlinkSNIRMargin;
+    auto picked = best;
+    int pickedLoad = getGatewayLoad(std::get<0>(*best));
+    for (auto it = gateways.begin(); it != gateways.end(); ++it) {
+        if (math::fraction2dB(std::get<1>(*it)) < minSNIR || isGatewayBackedOff(std::get<0>(*it)))
+            continue;
+        int load = getGatewayLoad(std::get<0>(*it));
+        if (load < pickedLoad || (load == pickedLoad && std::get<1>(*it) > std::get<1>(*picked))) {
+            picked = it;
+            pickedLoad = load;
+        }
+    }
+    if (picked != best)
+        numDownlinksAvoidingBusyGateway++;
+    return std::get<0>(*picked);
+}
+
+void NetworkServerApp::recordGatewayUplink(const L3Address& gwAddress)
+{
+    if (downlinkGatewayPolicy != "bestSnir")
+        gatewayUplinkTimes[gwAddress].push_back(simTime());
+}
+
+bool NetworkServerApp::isGatewayBackedOff(const L3Address& gwAddress)
+{
+    auto it = gatewayBackoffEnd.find(gwAddress);
+    return it != gatewayBackoffEnd.end() && it->second > simTime();
+}
+
+int NetworkServerApp::getGatewayLoad(const L3Address& gwAddress)
+{
+    auto& times = gatewayUplinkTimes[gwAddress];
+    while (!times.empty() && times.front() < simTime() - gatewayLoadWindow)
+        times.pop_front();
+    return times.size();
+}
+
+double NetworkServerApp::getRequiredSNIR(int spreadFactor)
+{
+    // demodulation floor in dB per spreading factor
+    static const double requiredSNIR[] = { -7.5, -10, -12.5, -15, -17.5, -20 };
+    if (spreadFactor < 7 || spreadFactor > 12)
+        throw cRuntimeError("Unsupported spreading factor %d", spreadFactor);
+    return requiredSNIR[spreadFactor - 7];
+}
+
+void NetworkServerApp::sendAck(const Ptr<const LoRaMacFrame>& frame, L3Address pickedGateway)
+{
+    auto frameToSend = makeShared<LoRaMacFrame>();
+    frameToSend->setChunkLength(B(par("headerLength").intValue()));
+    frameToSend->setReceiverAddress(frame->getTransmitterAddress());
+    frameToSend->setAck(true);
+    frameToSend->setTxTime(frame->getRxTime() + receiveDelay1);
+    frameToSend->setRx2Time(frame->getRxTime() + receiveDelay2);
+    frameToSend->setLoRaTP(math::dBmW2mW(14));
+    frameToSend->setLoRaCF(frame->getLoRaCF());
+    frameToSend->setLoRaSF(frame->getLoRaSF());
+    frameToSend->setLoRaBW(frame->getLoRaBW());
+
+    auto pktAux = new Packet("AckPacket");
+    pktAux->insertAtFront(frameToSend);
+    sendDownlink(pktAux, pickedGateway);
+    numAcksSent++;
+}
+
+void NetworkServerApp::sendJoinAccept(const Ptr<const LoRaMacFrame>& frame, L3Address pickedGateway)
+{
+    auto frameToSend = makeShared<LoRaMacFrame>();
+    frameToSend->setChunkLength(B(par("headerLength").intValue()));
+    frameToSend->setReceiverAddress(frame->getTransmitterAddress());
+    frameToSend->setJoinAccept(true);
+    frameToSend->setTxTime(frame->getRxTime() + receiveDelay1);
+    frameToSend->setRx2Time(frame->getRxTime() + receiveDelay2);
+    frameToSend->setLoRaTP(math::dBmW2mW(14));
+    frameToSend->setLoRaCF(frame->getLoRaCF());
+    frameToSend->setLoRaSF(frame->getLoRaSF());
+    frameToSend->setLoRaBW(frame->getLoRaBW());
+
+    auto pktAux = new Packet("JoinAccept");
+    pktAux->insertAtFront(frameToSend);
+    sendDownlink(pktAux, pickedGateway);
+    numJoinAcceptsSent++;
+}
+
+void NetworkServerApp::sendDownlink(Packet *pkt, const L3Address& gwAddress)
+{
+    // the gateway decides by the end of the last receive window (a ping slot
+    // is shorter than a receive window)
+    const auto& frame = pkt->peekAtFront<LoRaMacFrame>();
+    simtime_t deadline = std::max(simTime(), std::max(frame->getTxTime(), frame->getRx2Time())) + receiveWindowLength;
+    while (!downlinkDeadlines.empty() && downlinkDeadlines.begin()->first < simTime()) {
+        pendingDownlinks.erase(downlinkDeadlines.begin()->second);
+        downlinkDeadlines.erase(downlinkDeadlines.begin());
+    }
+    pendingDownlinks[pkt->getTreeId()] = gwAddress;
+    downlinkDeadlines.emplace(deadline, pkt->getTreeId());
+    if (backhaul != nullptr)
+        backhaul->sendDownlink(pkt, gwAddress);
+    else
+        socket.sendTo(pkt, gwAddress, destPort);
+}
+
+void NetworkServerApp::sendPingSlotDownlinks()
+{
+    // one downlink into the next ping slot of every Class B node heard so far,
+    // through the gateway and on the channel of its last uplink
+    for (const auto &node : knownNodes) {
+        if (node.lastGateway.isUnspecified() || !isPrimaryFor(node.srcAddr))
+            continue;
+        simtime_t slotStart = classBScheduler->getNextPingSlot(node.srcAddr, simTime() + pingSlotLeadTime);
+        if (slotStart < 0)
+            continue;
+        auto frameToSend = makeShared<LoRaMacFrame>();
+        // the payload only shows in the frame length, the MAC hands nothing up
+        frameToSend->setChunkLength(B(par("headerLength").intValue() + par("pingSlotDownlinkPayloadLength").intValue()));
+        frameToSend->setReceiverAddress(node.srcAddr);
+        frameToSend->setPingSlot(true);
+        frameToSend->setTxTime(slotStart);
+        frameToSend->setLoRaTP(math::dBmW2mW(14));
+        frameToSend->setLoRaCF(node.lastCF);
+        frameToSend->setLoRaSF(node.lastSF);
+        frameToSend->setLoRaBW(node.lastBW);
+
+        auto pktAux = new Packet("PingSlotDownlink");
+        pktAux->insertAtFront(frameToSend);
+        sendDownlink(pktAux, node.lastGateway);
+        numPingSlotDownlinksSent++;
+    }
+    scheduleAt(simTime() + par("pingSlotDownlinkInterval"), pingSlotDownlinkTimer);
+}
+
+bool NetworkServerApp::isPrimaryFor(const MacAddress& address) const
+{
+    return shardIndex < 0 || shardRing.getPrimaryServer(address) == shardIndex;
+}
+
+void NetworkServerApp::receiveSignal(cComponent *source, simsignal_t signalID, const SimTime& value, cObject *details)
+{
+    // a join wave lasts from the first node starting to join until all
+    // nodes that started meanwhile completed, e.g. after a power outage
+    if (!strcmp(getSignalName(signalID), "LoRa_JoinStarted")) {
+        if (pendingJoins++ == 0)
+            joinWaveStart = simTime();
+    }
+    else if (pendingJoins > 0 && --pendingJoins == 0)
+        networkRecoveryTime.collect(simTime() - joinWaveStart);
 }
 
 void NetworkServerApp::receiveSignal(cComponent *source, simsignal_t signalID, intval_t value, cObject *details)
 {
+    // back-pressure from the gateways' downlink queues; the details are the
+    // rejected downlink, which may have been sent by another network server
+    if (!strcmp(getSignalName(signalID), "LoRa_DownlinkRejected")) {
+        auto it = pendingDownlinks.find(check_and_cast<Packet *>(details)->getTreeId());
+        if (it == pendingDownlinks.end())
+            return;
+        if (value == LoRaFrameEvent::DL_REJECTED_TOO_LATE)
+            numDownlinksRejectedTooLate++;
+        else {
+            numDownlinksRejectedBusy++;
+            gatewayBackoffEnd[it->second] = simTime() + gatewayBackoffTime;
+        }
+        pendingDownlinks.erase(it);
+        return;
+    }
+    // with sharding only the packets of the nodes this server is primary for
+    auto it = ownedApps.find(source);
+    if (it == ownedApps.end()) {
+        auto mac = check_and_cast<LoRaMac *>(check_and_cast<cModule *>(source)->getParentModule()->getSubmodule("LoRaNic")->getSubmodule("mac"));
+        it = ownedApps.emplace(source, isPrimaryFor(mac->getAddress())).first;
+    }
+    if (!it->second)
+        return;
     if (simTime() >= getSimulation()->getWarmupPeriod())
     {
         counterOfSentPacketsFromNodes++;
@@ -25,10 +25,16 @@
 
 #include "LoRaMacControlInfo_m.h"
 #include "LoRaMacFrame_m.h"
+#include "LoRaFrameEvent.h"
 #include "inet/applications/base/ApplicationBase.h"
 #include "inet/transportlayer/contract/udp/UdpSocket.h"
 #include "../LoRaApp/LoRaAppPacket_m.h"
+#include "../LoRaApp/DataPacket_m.h"
+#include "LoRaBackhaul.h"
+#include "LoRaClassBScheduler.h"
+#include "LoRaServerRing.h"
 #include <list>
+#include <deque>
 
 namespace flora {
 
@@ -38,12 +44,18 @@ public:
     MacAddress srcAddr;
     int framesFromLastADRCommand;
     int lastSeqNoProcessed;
+    int lastSeqNoDelivered = -1;
     int numberOfSentADRPackets;
     std::list<double> adrListSNIR;
     cOutVector *historyAllSNIR;
     cOutVector *historyAllRSSI;
     cOutVector *receivedSeqNumber;
     cOutVector *calculatedSNRmargin;
+    /** Gateway and channel of the last processed uplink, used for Class B downlinks */
+    L3Address lastGateway;
+    Hz lastCF = Hz(NaN);
+    int lastSF = -1;
+    Hz lastBW = Hz(NaN);
 };
 
 class knownGW
@@ -70,11 +82,73 @@ class NetworkServerApp : public cSimpleModule, cListener
     std::vector<std::tuple<MacAddress, int>> recvdPackets;
     // state
     UdpSocket socket;
+    /** Backhaul to the gateways instead of the socket, if any */
+    LoRaBackhaul *backhaul = nullptr;
     cMessage *selfMsg = nullptr;
     int totalReceivedPackets;
     std::string adrMethod;
     double adrDeviceMargin;
     std::map<int, int> numReceivedPerNode;
+    int numAcksSent = 0;
+    int numRetransmissionsReceived = 0;
+    int numJoinRequestsReceived = 0;
+    int numJoinAcceptsSent = 0;
+    /** Nodes that started joining and did not complete yet, reported by their MACs */
+    int pendingJoins = 0;
+    /** Start of the current join wave, i.e. when pendingJoins last left zero */
+    simtime_t joinWaveStart = -1;
+    cStdDev networkRecoveryTime;
+    /** Downlink target times relative to the uplink reception, i.e. the starts of RX1 and RX2 */
+    simtime_t receiveDelay1;
+    simtime_t receiveDelay2;
+    simtime_t receiveWindowLength;
+    /** How long the copies of an uplink from other gateways are collected before it is processed */
+    simtime_t deduplicationWindow;
+    /** Downlinks of this server the gateways rejected, too late for both receive windows or busy */
+    int numDownlinksRejectedTooLate = 0;
+    int numDownlinksRejectedBusy = 0;
+    /**
+     * Gateway of each downlink sent, keyed by the packet tree id, until the
+     * gateway must have decided on it. Lets the server pick out the
+     * rejections of its own downlinks among those of all servers.
+     */
+    std::map<msgid_t, L3Address> pendingDownlinks;
+    /** Tree ids of the pending downlinks by the time the gateway must have decided on them */
+    std::multimap<simtime_t, msgid_t> downlinkDeadlines;
+    /** A gateway that rejected a downlink as busy is avoided until this time */
+    std::map<L3Address, simtime_t> gatewayBackoffEnd;
+    simtime_t gatewayBackoffTime;
+    int numDownlinksAvoidingBackedOffGateway = 0;
+
+    /** @name Downlink gateway choice */
+    //@{
+    std::string downlinkGatewayPolicy;
+    simtime_t gatewayLoadWindow;
+    double downlinkSNIRMargin;
+    /** Arrival times of the uplink copies forwarded by each gateway within gatewayLoadWindow */
+    std::map<L3Address, std::deque<simtime_t>> gatewayUplinkTimes;
+    int numDownlinksAvoidingBusyGateway = 0;
+    //@}
+
+    /** @name Class B downlinks into the ping slots */
+    //@{
+    LoRaClassBScheduler *classBScheduler = nullptr;
+    cMessage *pingSlotDownlinkTimer = nullptr;
+    simtime_t pingSlotLeadTime;
+    int numPingSlotDownlinksSent = 0;
+    //@}
+
+    /**
+     * @name Sharding
+     * The ring of the packet forwarders over numShards servers. Replicas of a
+     * node keep its state from the uplinks, only its primary server answers.
+     */
+    //@{
+    int shardIndex = -1;
+    LoRaServerRing shardRing;
+    /** Whether the node of each app emitting LoRa_AppPacketSent is owned */
+    std::map<const cComponent *, bool> ownedApps;
+    //@}
 
   protected:
     virtual void initialize(int stage) override;
@@ -87,13 +161,31 @@ class NetworkServerApp : public cSimpleModule, cListener
     bool isPacketProcessed(const Ptr<const LoRaMacFrame> &);
     void updateKnownNodes(Packet* pkt);
     void addPktToProcessingTable(Packet* pkt);
+    void emitFrameEvent(const Ptr<const LoRaMacFrame>& frame, LoRaFrameEvent::Outcome outcome);
     void processScheduledPacket(cMessage* selfMsg);
-    void evaluateADR(Packet *pkt, L3Address pickedGateway, double SNIRinGW, double RSSIinGW);
+    bool evaluateADR(Packet *pkt, L3Address pickedGateway, double SNIRinGW, double RSSIinGW);
+    void sendAck(const Ptr<const LoRaMacFrame>& frame, L3Address pickedGateway);
+    void sendJoinAccept(const Ptr<const LoRaMacFrame>& frame, L3Address pickedGateway);
+    void sendDownlink(Packet *pkt, const L3Address& gwAddress);
+    void sendPingSlotDownlinks();
     void receiveSignal(cComponent *source, simsignal_t signalID, intval_t value, cObject *details) override;
+    /**
+     * Downlink policy hook: picks the gateway that sends the downlink for a
+     * processed uplink among the gateways that received it.
+     */
+    virtual L3Address pickDownlinkGateway(const receivedPacket& packet);
+    void recordGatewayUplink(const L3Address& gwAddress);
+    int getGatewayLoad(const L3Address& gwAddress);
+    bool isGatewayBackedOff(const L3Address& gwAddress);
+    /** Whether this server is the primary one of the node, always true without sharding */
+    bool isPrimaryFor(const MacAddress& address) const;
+    static double getRequiredSNIR(int spreadFactor);
+    void receiveSignal(cComponent *source, simsignal_t signalID, const SimTime& value, cObject *details) override;
     bool evaluateADRinServer;
 
     cHistogram receivedRSSI;
   public:
+    virtual ~NetworkServerApp();
     simsignal_t LoRa_ServerPacketReceived;
     int counterOfSentPacketsFromNodes = 0;
     int counterOfSentPacketsFromNodesPerSF[6];
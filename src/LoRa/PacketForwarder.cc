@@ -21,6 +21,9 @@
 #include "inet/applications/base/ApplicationPacket_m.h"
 #include "../LoRaPhy/LoRaRadioControlInfo_m.h"
 #include "inet/physicallayer/wireless/common/contract/packetlevel/SignalTag_m.h"
+#include "LoRaFrameEvent.h"
+#include "../LoRaApp/LoRaAppPacket_m.h"
+#include "../LoRaApp/DataPacket_m.h"
 
 
 namespace flora {
@@ -34,6 +37,8 @@ void PacketForwarder::initialize(int stage)
         LoRa_GWPacketReceived = registerSignal("LoRa_GWPacketReceived");
         localPort = par("localPort");
         destPort = par("destPort");
+        if (*par("backhaulModule").stringValue())
+            backhaul = getModuleFromPar<LoRaBackhaul>(par("backhaulModule"), this);
     } else if (stage == INITSTAGE_APPLICATION_LAYER) {
         startUDP();
         getSimulation()->getSystemModule()->subscribe("LoRa_AppPacketSent", this);
@@ -60,7 +65,13 @@ void PacketForwarder::startUDP()
         EV << "Wchodze w petle" << endl;
         EV << token << endl;
         L3Address result;
-        L3AddressResolver().tryResolve(token, result);
+        if (backhaul != nullptr) {
+            // network servers reached over the backhaul are given by module path
+            if (cModule *server = findModuleByPath(token))
+                result = LoRaBackhaul::getAddress(server);
+        }
+        else
+            L3AddressResolver().tryResolve(token, result);
         EV << "Wychodze z petli" << endl;
         if (result.isUnspecified())
             EV_ERROR << "cannot resolve destination address: " << token << endl;
@@ -68,24 +79,25 @@ void PacketForwarder::startUDP()
             EV << "Got destination address: " << token << endl;
         destAddresses.push_back(result);
     }
+    buildServerRing();
     EV << "Dojechalismy do konca" << endl;
 }
 
 
 void PacketForwarder::handleMessage(cMessage *msg)
 {
-    EV << msg->getArrivalGate() << endl;
+    EV_DEBUG << msg->getArrivalGate() << endl;
     if (msg->arrivedOn("lowerLayerIn")) {
-        EV << "Received LoRaMAC frame" << endl;
+        EV_DEBUG << "Received LoRaMAC frame" << endl;
         auto pkt = check_and_cast<Packet*>(msg);
         const auto &frame = pkt->peekAtFront<LoRaMacFrame>();
         if(frame->getReceiverAddress() == MacAddress::BROADCAST_ADDRESS)
             processLoraMACPacket(pkt);
         //send(msg, "upperLayerOut");
         //sendPacket();
-    } else if (msg->arrivedOn("socketIn")) {
+    } else if (msg->arrivedOn("socketIn") || msg->arrivedOn("backhaulIn")) {
         // FIXME : debug for now to see if LoRaMAC frame received correctly from network server
-        EV << "Received UDP packet" << endl;
+        EV_DEBUG << "Received UDP packet" << endl;
         auto pkt = check_and_cast<Packet*>(msg);
         const auto &frame = pkt->peekAtFront<LoRaMacFrame>();
 
@@ -122,19 +134,68 @@ void PacketForwarder::processLoraMACPacket(Packet *pk)
     W w_rssi = signalPowerInd->getPower();
     double rssi = w_rssi.get()*1000;
     frame->setRSSI(math::mW2dBmW(rssi));
+    frame->setRxTime(simTime());
     frame->setSNIR(snirInd->getMinimumSnir());
+    emitFrameEvent(pk, frame);
     pk->insertAtFront(frame);
 
     //bool exist = false;
-    EV << frame->getTransmitterAddress() << endl;
+    EV_DEBUG << frame->getTransmitterAddress() << endl;
     //for (std::vector<nodeEntry>::iterator it = knownNodes.begin() ; it != knownNodes.end(); ++it)
 
-    // FIXME : Identify network server message is destined for.
-    L3Address destAddr = destAddresses[0];
     if (pk->getControlInfo())
        delete pk->removeControlInfo();
+    if (destAddresses.empty()) {
+        delete pk;
+        return;
+    }
+
+    // the network servers of the node, the replicas get copies
+    std::vector<int> servers = serverRing.getServers(frame->getTransmitterAddress(), replicationFactor);
+    for (size_t i = 0; i < servers.size(); i++) {
+        Packet *copy = i + 1 < servers.size() ? pk->dup() : pk;
+        const L3Address& destAddr = destAddresses[servers[i]];
+        numForwardedPerServer[servers[i]]++;
+        if (backhaul != nullptr)
+            backhaul->sendUplink(this, copy, destAddr);
+        else
+            socket.sendTo(copy, destAddr, destPort);
+    }
+}
 
-    socket.sendTo(pk, destAddr, destPort);
+void PacketForwarder::emitFrameEvent(Packet *pk, const Ptr<const LoRaMacFrame>& frame)
+{
+    if (!mayHaveListeners(LoRaFrameEvent::loRaFrameEventSignal))
+        return;
+    // everything the network server looks at, so that the trace can be replayed
+    LoRaFrameEvent event(LoRaFrameEvent::GW_FORWARDED, LoRaFrameEvent::OUTCOME_NONE);
+    event.nodeAddress = frame->getTransmitterAddress();
+    event.sequenceNumber = frame->getSequenceNumber();
+    event.spreadFactor = frame->getLoRaSF();
+    event.power = frame->getRSSI();
+    event.snir = math::fraction2dB(frame->getSNIR());
+    event.txPower = math::mW2dBmW(frame->getLoRaTP()) + 30; // uplinks carry the power in W
+    if (frame->getConfirmed())
+        event.flags |= LoRaFrameEvent::FLAG_CONFIRMED;
+    if (frame->getJoinRequest())
+        event.flags |= LoRaFrameEvent::FLAG_JOIN_REQUEST;
+    if (pk->getDataLength() > b(0)) {
+        const auto& payload = pk->peekAtFront<Chunk>();
+        auto appPacket = dynamicPtrCast<const LoRaAppPacket>(payload);
+        auto sensorPacket = dynamicPtrCast<const LoRaSensorPacket>(payload);
+        if ((appPacket != nullptr && appPacket->getOptions().getADRACKReq()) || (sensorPacket != nullptr && sensorPacket->getADRACKReq()))
+            event.flags |= LoRaFrameEvent::FLAG_ADR_ACK_REQ;
+    }
+    emit(LoRaFrameEvent::loRaFrameEventSignal, &event);
+}
+
+void PacketForwarder::buildServerRing()
+{
+    replicationFactor = std::min(par("replicationFactor").intValue(), (intval_t)destAddresses.size());
+    numForwardedPerServer.assign(destAddresses.size(), 0);
+    // every gateway builds the same ring, so the copies of an uplink received
+    // by several gateways meet at the same network servers
+    serverRing.build(destAddresses.size(), par("virtualNodesPerServer"));
 }
 
 void PacketForwarder::sendPacket()
@@ -165,6 +226,9 @@ void PacketForwarder::receiveSignal(cComponent *source, simsignal_t signalID, in
 void PacketForwarder::finish()
 {
     recordScalar("LoRa_GW_DER", double(counterOfReceivedPackets)/counterOfSentPacketsFromNodes);
+    if (destAddresses.size() > 1)
+        for (size_t i = 0; i < destAddresses.size(); i++)
+            recordScalar(("numForwardedToServer " + std::to_string(i)).c_str(), numForwardedPerServer[i]);
 }
 
 
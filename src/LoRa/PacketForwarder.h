@@ -19,12 +19,15 @@
 #include <omnetpp.h>
 #include "inet/physicallayer/wireless/common/contract/packetlevel/RadioControlInfo_m.h"
 #include <vector>
+#include <map>
 #include "inet/common/INETDefs.h"
 
 #include "LoRaMacControlInfo_m.h"
 #include "LoRaMacFrame_m.h"
 #include "inet/applications/base/ApplicationBase.h"
 #include "inet/transportlayer/contract/udp/UdpSocket.h"
+#include "LoRaBackhaul.h"
+#include "LoRaServerRing.h"
 
 namespace flora {
 
@@ -32,9 +35,15 @@ class PacketForwarder : public cSimpleModule, public cListener
 {
   protected:
     std::vector<L3Address> destAddresses;
+    /** Consistent hash ring over destAddresses */
+    LoRaServerRing serverRing;
+    int replicationFactor = 1;
+    std::vector<long> numForwardedPerServer;
     int localPort = -1, destPort = -1;
     // state
     UdpSocket socket;
+    /** Backhaul to the network servers instead of the socket, if any */
+    LoRaBackhaul *backhaul = nullptr;
     cMessage *selfMsg = nullptr;
 
   protected:
@@ -42,6 +51,8 @@ class PacketForwarder : public cSimpleModule, public cListener
     virtual void handleMessage(cMessage *msg) override;
     virtual void finish() override;
     void processLoraMACPacket(Packet *pk);
+    void emitFrameEvent(Packet *pk, const Ptr<const LoRaMacFrame>& frame);
+    void buildServerRing();
     void startUDP();
     void sendPacket();
     void setSocketOptions();
@@ -0,0 +1,153 @@
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+// 
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see http://www.gnu.org/licenses/.
+// 
+
+#include "EnvironmentField.h"
+#include "inet/common/INETMath.h"
+
+namespace flora {
+
+Define_Module(EnvironmentField);
+
+void EnvironmentField::initialize()
+{
+    sizeX = par("sizeX");
+    sizeY = par("sizeY");
+    cellSize = par("cellSize");
+    numX = (int)std::ceil(sizeX / cellSize) + 1;
+    numY = (int)std::ceil(sizeY / cellSize) + 1;
+    timeStep = par("timeStep");
+    baseTemperature = par("baseTemperature");
+    amplitudeTemperature = par("amplitudeTemperature");
+    baseHumidity = par("baseHumidity");
+    amplitudeHumidity = par("amplitudeHumidity");
+    humidityPerDegree = par("humidityPerDegree");
+    baseNO2 = par("baseNO2");
+    amplitudeNO2 = par("amplitudeNO2");
+    windDirection = math::deg2rad(par("windDirection").doubleValue());
+    windDirectionVariation = math::deg2rad(par("windDirectionVariation").doubleValue());
+    plumeWidth = par("plumeWidth");
+    plumeSpread = par("plumeSpread");
+    plumeLength = par("plumeLength");
+    int numPlumes = par("numPlumes");
+    for (int i = 0; i < numPlumes; i++)
+        plumes.push_back({uniform(0, sizeX), uniform(0, sizeY), par("plumeStrength").doubleValue()});
+    computeTemperatureAnomaly();
+    computeFrame(current, 0);
+    computeFrame(next, timeStep);
+    WATCH(numFrames);
+}
+
+void EnvironmentField::handleMessage(cMessage *msg)
+{
+    throw cRuntimeError("This module does not handle messages");
+}
+
+void EnvironmentField::computeTemperatureAnomaly()
+{
+    // a few random plane waves of the correlation length give a smooth
+    // field, scaled to the requested standard deviation
+    double correlationLength = par("correlationLength");
+    int numWaves = par("numWaves");
+    double spatialStd = par("temperatureSpatialStd");
+    std::vector<double> kx, ky, phase;
+    for (int w = 0; w < numWaves; w++) {
+        double direction = uniform(0, 2 * M_PI);
+        kx.push_back(2 * M_PI / correlationLength * cos(direction));
+        ky.push_back(2 * M_PI / correlationLength * sin(direction));
+        phase.push_back(uniform(0, 2 * M_PI));
+    }
+    double scale = numWaves > 0 ? spatialStd * sqrt(2.0 / numWaves) : 0;
+    temperatureAnomaly.resize(numX * numY);
+    for (int j = 0; j < numY; j++)
+        for (int i = 0; i < numX; i++) {
+            double sum = 0;
+            for (int w = 0; w < numWaves; w++)
+                sum += cos(kx[w] * i * cellSize + ky[w] * j * cellSize + phase[w]);
+            temperatureAnomaly[j * numX + i] = scale * sum;
+        }
+}
+
+void EnvironmentField::computeFrame(Frame& frame, simtime_t time)
+{
+    numFrames++;
+    frame.time = time;
+    double hours = time.dbl() / 3600.0;
+    double temperature = baseTemperature + amplitudeTemperature * sin(2 * M_PI * (hours / 24.0));
+    double humidity = baseHumidity + amplitudeHumidity * sin(2 * M_PI * (hours / 24.0) + M_PI / 4);
+    double no2 = baseNO2 + amplitudeNO2 * (0.5 + 0.5 * sin(2 * M_PI * (hours / 12.0)));
+    // the wind turns over the day and carries the plumes downwind
+    double wind = windDirection + windDirectionVariation * sin(2 * M_PI * (hours / 24.0));
+    double windX = cos(wind), windY = sin(wind);
+    for (auto& values : frame.values)
+        values.resize(numX * numY);
+    for (int j = 0; j < numY; j++)
+        for (int i = 0; i < numX; i++) {
+            int index = j * numX + i;
+            double anomaly = temperatureAnomaly[index];
+            frame.values[TEMPERATURE][index] = temperature + anomaly;
+            frame.values[HUMIDITY][index] = humidity - humidityPerDegree * anomaly;
+            double concentration = no2;
+            for (const auto& plume : plumes) {
+                double dx = i * cellSize - plume.x, dy = j * cellSize - plume.y;
+                double downwind = dx * windX + dy * windY;
+                if (downwind < 0)
+                    continue;
+                double crosswind = -dx * windY + dy * windX;
+                double width = plumeWidth + plumeSpread * downwind;
+                concentration += plume.strength * exp(-downwind / plumeLength - crosswind * crosswind / (2 * width * width));
+            }
+            frame.values[NO2][index] = concentration;
+        }
+}
+
+void EnvironmentField::advanceTo(simtime_t time)
+{
+    while (next.time <= time) {
+        std::swap(current, next);
+        computeFrame(next, current.time + timeStep);
+    }
+}
+
+double EnvironmentField::interpolate(const std::vector<float>& values, double fx, double fy, int i, int j) const
+{
+    int index = j * numX + i;
+    double bottom = values[index] + fx * (values[index + 1] - values[index]);
+    double top = values[index + numX] + fx * (values[index + numX + 1] - values[index + numX]);
+    return bottom + fy * (top - bottom);
+}
+
+double EnvironmentField::sample(Quantity quantity, const Coord& position)
+{
+    Enter_Method_Silent("sample");
+    simtime_t now = simTime();
+    if (now >= next.time)
+        advanceTo(now);
+    double x = std::min(std::max(position.x / cellSize, 0.0), numX - 1.0);
+    double y = std::min(std::max(position.y / cellSize, 0.0), numY - 1.0);
+    int i = std::min((int)x, numX - 2);
+    int j = std::min((int)y, numY - 2);
+    double fx = x - i, fy = y - j;
+    double now0 = interpolate(current.values[quantity], fx, fy, i, j);
+    double now1 = interpolate(next.values[quantity], fx, fy, i, j);
+    double ft = (now - current.time) / timeStep;
+    return now0 + ft * (now1 - now0);
+}
+
+void EnvironmentField::finish()
+{
+    recordScalar("numFrames", numFrames);
+}
+
+} // namespace flora
@@ -0,0 +1,87 @@
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+// 
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see http://www.gnu.org/licenses/.
+// 
+
+#ifndef LORAAPP_ENVIRONMENTFIELD_H_
+#define LORAAPP_ENVIRONMENTFIELD_H_
+
+#include <vector>
+
+#include "inet/common/INETDefs.h"
+#include "inet/common/geometry/common/Coord.h"
+
+namespace flora {
+
+using namespace inet;
+
+/**
+ * Gridded, time-evolving temperature, humidity and NO2 field shared by the
+ * sensor apps. See EnvironmentField.ned.
+ */
+class EnvironmentField : public cSimpleModule
+{
+  public:
+    enum Quantity { TEMPERATURE = 0, HUMIDITY = 1, NO2 = 2, NUM_QUANTITIES = 3 };
+
+  protected:
+    /** Grid values of all quantities at one time step, row major */
+    struct Frame
+    {
+        simtime_t time;
+        std::vector<float> values[NUM_QUANTITIES];
+    };
+
+    struct Plume
+    {
+        double x, y;
+        double strength;
+    };
+
+    double sizeX = NaN, sizeY = NaN;
+    double cellSize = NaN;
+    int numX = 0, numY = 0;
+    simtime_t timeStep;
+
+    double baseTemperature = NaN, amplitudeTemperature = NaN;
+    double baseHumidity = NaN, amplitudeHumidity = NaN, humidityPerDegree = NaN;
+    double baseNO2 = NaN, amplitudeNO2 = NaN;
+    double windDirection = NaN, windDirectionVariation = NaN;
+    double plumeWidth = NaN, plumeSpread = NaN, plumeLength = NaN;
+
+    /** Static temperature anomaly per grid point, e.g. urban heat islands */
+    std::vector<float> temperatureAnomaly;
+    std::vector<Plume> plumes;
+    Frame current;
+    Frame next;
+
+    long numFrames = 0;
+
+  protected:
+    virtual void initialize() override;
+    virtual void handleMessage(cMessage *msg) override;
+    virtual void finish() override;
+
+    virtual void computeTemperatureAnomaly();
+    virtual void computeFrame(Frame& frame, simtime_t time);
+    virtual void advanceTo(simtime_t time);
+    double interpolate(const std::vector<float>& values, double fx, double fy, int i, int j) const;
+
+  public:
+    /** Value of the quantity at the position and the current time */
+    virtual double sample(Quantity quantity, const Coord& position);
+};
+
+} // namespace flora
+
+#endif /* LORAAPP_ENVIRONMENTFIELD_H_ */
@@ -0,0 +1,144 @@
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+// 
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see http://www.gnu.org/licenses/.
+// 
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+
+#include "SensorTrace.h"
+
+namespace flora {
+
+Define_Module(SensorTrace);
+
+void SensorTrace::initialize()
+{
+    const char *fileName = par("traceFile");
+    std::ifstream in(fileName, std::ios::in | std::ios::binary);
+    if (!in.is_open())
+        throw cRuntimeError("Cannot open sensor trace file '%s'", fileName);
+    std::vector<std::pair<int, SensorTraceEntry>> records;
+    char magic[4] = {};
+    in.read(magic, 4);
+    if (in && strncmp(magic, "WSTR", 4) == 0)
+        readBinary(in, fileName, records);
+    else {
+        in.clear();
+        in.seekg(0);
+        readCsv(in, fileName, records);
+    }
+    // one contiguous block per node, so that a node only needs a cursor
+    std::stable_sort(records.begin(), records.end(), [] (const std::pair<int, SensorTraceEntry>& a, const std::pair<int, SensorTraceEntry>& b) {
+        return a.first != b.first ? a.first < b.first : a.second.time < b.second.time;
+    });
+    simtime_t timeOffset = par("timeOffset");
+    entries.reserve(records.size());
+    for (const auto& record : records) {
+        auto& range = nodeRanges[record.first];
+        if (range.second == 0)
+            range.first = entries.size();
+        entries.push_back(record.second);
+        entries.back().time += timeOffset;
+        range.second = entries.size();
+    }
+    EV_INFO << "Loaded " << entries.size() << " sensor trace entries of " << nodeRanges.size() << " nodes" << endl;
+}
+
+void SensorTrace::readBinary(std::istream& in, const char *fileName, std::vector<std::pair<int, SensorTraceEntry>>& records)
+{
+    uint32_t count;
+    in.read(reinterpret_cast<char *>(&count), sizeof(count));
+    if (!in)
+        throw cRuntimeError("Truncated sensor trace '%s'", fileName);
+    // records are packed: int32 node, double time, uint8 bitmap, float temperature, float no2, float humidity, int32 counter
+    const size_t recordSize = 4 + 8 + 1 + 4 + 4 + 4 + 4;
+    std::vector<char> buffer(recordSize * count);
+    in.read(buffer.data(), buffer.size());
+    if ((size_t)in.gcount() != buffer.size())
+        throw cRuntimeError("Truncated sensor trace '%s'", fileName);
+    records.reserve(count);
+    const char *data = buffer.data();
+    auto field = [&data] (auto& value) {
+        memcpy(&value, data, sizeof(value));
+        data += sizeof(value);
+    };
+    for (uint32_t k = 0; k < count; k++) {
+        int32_t node, counter;
+        double time;
+        uint8_t bitmap;
+        SensorTraceEntry entry;
+        field(node);
+        field(time);
+        field(bitmap);
+        field(entry.temperature);
+        field(entry.no2);
+        field(entry.humidity);
+        field(counter);
+        entry.time = time;
+        entry.bitmap = bitmap;
+        entry.counter = counter;
+        records.emplace_back(node, entry);
+    }
+}
+
+void SensorTrace::readCsv(std::istream& in, const char *fileName, std::vector<std::pair<int, SensorTraceEntry>>& records)
+{
+    // node,time,bitmap,temperature,no2,humidity,counter; empty fields for absent values
+    std::string line;
+    int lineNumber = 0;
+    while (std::getline(in, line)) {
+        lineNumber++;
+        if (line.empty() || line[0] == '#' || !isdigit(line[0]))
+            continue;   // comments and the header
+        std::vector<std::string> fields;
+        std::stringstream stream(line);
+        std::string field;
+        while (std::getline(stream, field, ','))
+            fields.push_back(field);
+        if (fields.size() < 3)
+            throw cRuntimeError("%s:%d: expected node,time,bitmap[,temperature,no2,humidity,counter]", fileName, lineNumber);
+        fields.resize(7);
+        auto number = [] (const std::string& text) { return text.empty() ? NAN : atof(text.c_str()); };
+        SensorTraceEntry entry;
+        entry.time = atof(fields[1].c_str());
+        entry.bitmap = atoi(fields[2].c_str());
+        entry.temperature = number(fields[3]);
+        entry.no2 = number(fields[4]);
+        entry.humidity = number(fields[5]);
+        entry.counter = atoi(fields[6].c_str());
+        records.emplace_back(atoi(fields[0].c_str()), entry);
+    }
+}
+
+void SensorTrace::handleMessage(cMessage *msg)
+{
+    throw cRuntimeError("This module does not handle messages");
+}
+
+SensorTrace::Range SensorTrace::getEntries(int nodeIndex) const
+{
+    auto it = nodeRanges.find(nodeIndex);
+    if (it == nodeRanges.end())
+        return Range(nullptr, nullptr);
+    return Range(entries.data() + it->second.first, entries.data() + it->second.second);
+}
+
+void SensorTrace::finish()
+{
+    recordScalar("numTraceEntries", entries.size());
+    recordScalar("numTracedNodes", nodeRanges.size());
+}
+
+} // namespace flora
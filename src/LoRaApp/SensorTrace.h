@@ -0,0 +1,72 @@
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+// 
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see http://www.gnu.org/licenses/.
+// 
+
+#ifndef LORAAPP_SENSORTRACE_H_
+#define LORAAPP_SENSORTRACE_H_
+
+#include <map>
+#include <vector>
+
+#include "inet/common/INETDefs.h"
+
+namespace flora {
+
+using namespace inet;
+
+/**
+ * Recorded uplink of a sensor node
+ */
+struct SensorTraceEntry
+{
+    simtime_t time;
+    int bitmap;
+    float temperature;
+    float no2;
+    float humidity;
+    int counter;
+};
+
+/**
+ * Per-node sensor traffic traces loaded once for all wlam_sensor_app
+ * instances. See SensorTrace.ned.
+ */
+class SensorTrace : public cSimpleModule
+{
+  public:
+    /** Entries of one node, in time order */
+    typedef std::pair<const SensorTraceEntry *, const SensorTraceEntry *> Range;
+
+  protected:
+    /** All entries grouped by node, then ordered by time */
+    std::vector<SensorTraceEntry> entries;
+    /** Node index -> [begin, end) in entries */
+    std::map<int, std::pair<size_t, size_t>> nodeRanges;
+
+  protected:
+    virtual void initialize() override;
+    virtual void handleMessage(cMessage *msg) override;
+    virtual void finish() override;
+
+    virtual void readBinary(std::istream& in, const char *fileName, std::vector<std::pair<int, SensorTraceEntry>>& records);
+    virtual void readCsv(std::istream& in, const char *fileName, std::vector<std::pair<int, SensorTraceEntry>>& records);
+
+  public:
+    /** Entries of the node with the given index, empty if it has none */
+    virtual Range getEntries(int nodeIndex) const;
+};
+
+} // namespace flora
+
+#endif /* LORAAPP_SENSORTRACE_H_ */
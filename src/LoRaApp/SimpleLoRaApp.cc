@@ -16,6 +16,7 @@
 #include "SimpleLoRaApp.h"
 #include "inet/mobility/static/StationaryMobility.h"
 #include "../LoRa/LoRaTagInfo_m.h"
+#include "../LoRa/LoRaSFAssigner.h"
 #include "inet/common/packet/Packet.h"
 
 
@@ -43,11 +44,15 @@ void SimpleLoRaApp::initialize(int stage)
         isOperational = (!nodeStatus) || nodeStatus->getState() == NodeStatus::UP;
         if (!isOperational)
             throw cRuntimeError("This module doesn't support starting in node DOWN state");
-        do {
-            timeToFirstPacket = par("timeToFirstPacket");
-            EV << "Wylosowalem czas :" << timeToFirstPacket << endl;
-            //if(timeToNextPacket < 5) error("Time to next packet must be grater than 3");
-        } while(timeToFirstPacket <= 5);
+        // every node is placed by now, so the link budgets can be computed
+        if (*par("sfAssignerModule").stringValue())
+            getModuleFromPar<LoRaSFAssigner>(par("sfAssignerModule"), this)->getAssignment(loRaRadio, loRaRadio->loRaSF, loRaRadio->loRaTP);
+        customIntervals = !strcmp(par("trafficModel"), "custom");
+        if (!customIntervals)
+            trafficModel = TrafficModel(getRNG(0), TrafficModel::readParameters(this, par("meanInterval").doubleValue()));
+        // no packet in the first 5 seconds
+        timeToFirstPacket = drawInterval("timeToFirstPacket", 5);
+        EV << "Wylosowalem czas :" << timeToFirstPacket << endl;
 
         //timeToFirstPacket = par("timeToFirstPacket");
         sendMeasurements = new cMessage("sendMeasurements");
@@ -107,6 +112,20 @@ void SimpleLoRaApp::finish()
     recordScalar("receivedADRCommands", receivedADRCommands);
 }
 
+simtime_t SimpleLoRaApp::drawInterval(const char *legacyPar, simtime_t minInterval)
+{
+    if (!customIntervals)
+        return trafficModel.nextInterval(simTime(), minInterval);
+    // redrawn as before the traffic models, but a distribution that hardly
+    // ever exceeds the minimum is an error instead of a hang
+    for (int i = 0; i < maxCustomDraws; i++) {
+        simtime_t interval = par(legacyPar);
+        if (interval > minInterval)
+            return interval;
+    }
+    throw cRuntimeError("%s did not exceed %s in %d draws", legacyPar, minInterval.str().c_str(), maxCustomDraws);
+}
+
 void SimpleLoRaApp::handleMessage(cMessage *msg)
 {
     if (msg->isSelfMessage()) {
@@ -126,10 +145,8 @@ void SimpleLoRaApp::handleMessage(cMessage *msg)
                 if(loRaSF == 10) time = 49.3568;
                 if(loRaSF == 11) time = 85.6064;
                 if(loRaSF == 12) time = 171.2128;
-                do {
-                    timeToNextPacket = par("timeToNextPacket");
-                    //if(timeToNextPacket < 3) error("Time to next packet must be grater than 3");
-                } while(timeToNextPacket <= time);
+                // at least the airtime of the SF apart
+                timeToNextPacket = drawInterval("timeToNextPacket", time);
                 sendMeasurements = new cMessage("sendMeasurements");
                 scheduleAt(simTime() + timeToNextPacket, sendMeasurements);
             }
@@ -218,8 +235,8 @@ void SimpleLoRaApp::sendJoinRequest()
 
     sfVector.record(getSF());
     tpVector.record(getTP());
-    EV << "Wysylam pakiet z TP: " << getTP() << endl;
-    EV << "Wysylam pakiet z SF: " << getSF() << endl;
+    EV_DEBUG << "Wysylam pakiet z TP: " << getTP() << endl;
+    EV_DEBUG << "Wysylam pakiet z SF: " << getSF() << endl;
     pktRequest->insertAtBack(payload);
     send(pktRequest, "socketOut");
     if(evaluateADRinNode)
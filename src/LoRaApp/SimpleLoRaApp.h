@@ -25,6 +25,7 @@
 #include "LoRaAppPacket_m.h"
 #include "LoRa/LoRaMacControlInfo_m.h"
 #include "LoRa/LoRaRadio.h"
+#include "TrafficModel.h"
 
 using namespace omnetpp;
 using namespace inet;
@@ -47,6 +48,8 @@ class SimpleLoRaApp : public cSimpleModule, public ILifecycle
         std::pair<double,double> generateUniformCircleCoordinates(double radius, double gatewayX, double gatewayY);
         void sendJoinRequest();
         void sendDownMgmtPacket();
+        /** Next packet interval above minInterval, from legacyPar with the "custom" traffic model */
+        simtime_t drawInterval(const char *legacyPar, simtime_t minInterval);
 
         int numberOfPacketsToSend;
         int sentPackets;
@@ -54,6 +57,10 @@ class SimpleLoRaApp : public cSimpleModule, public ILifecycle
         int lastSentMeasurement;
         simtime_t timeToFirstPacket;
         simtime_t timeToNextPacket;
+        TrafficModel trafficModel;
+        /** trafficModel "custom": intervals from the timeToFirstPacket and timeToNextPacket parameters */
+        bool customIntervals = false;
+        static const int maxCustomDraws = 1000;
 
         cMessage *configureLoRaParameters;
         cMessage *sendMeasurements;
@@ -0,0 +1,144 @@
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+// 
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see http://www.gnu.org/licenses/.
+// 
+
+#include "TrafficModel.h"
+
+namespace flora {
+
+TrafficModel::Parameters TrafficModel::readParameters(cComponent *owner, simtime_t meanInterval)
+{
+    Parameters parameters;
+    std::string kind = owner->par("trafficModel").stdstringValue();
+    if (kind == "periodic")
+        parameters.kind = PERIODIC;
+    else if (kind == "exponential")
+        parameters.kind = EXPONENTIAL;
+    else if (kind == "mmpp")
+        parameters.kind = MMPP;
+    else if (kind == "diurnal")
+        parameters.kind = DIURNAL;
+    else
+        throw cRuntimeError(owner, "Unknown traffic model '%s'", kind.c_str());
+    if (meanInterval <= 0)
+        throw cRuntimeError(owner, "The mean packet interval must be positive");
+    parameters.meanInterval = meanInterval;
+    parameters.jitterFraction = owner->par("intervalJitterFraction").doubleValue();
+    parameters.maxInterval = owner->par("maxInterval").doubleValue();
+    parameters.burstRateFactor = owner->par("burstRateFactor").doubleValue();
+    parameters.meanBurstLength = owner->par("meanBurstLength").doubleValue();
+    parameters.meanQuietLength = owner->par("meanQuietLength").doubleValue();
+    if (parameters.kind == MMPP) {
+        if (parameters.burstRateFactor <= 0)
+            throw cRuntimeError(owner, "burstRateFactor must be positive");
+        if (parameters.meanBurstLength < 0 || parameters.meanQuietLength < 0)
+            throw cRuntimeError(owner, "meanBurstLength and meanQuietLength must not be negative");
+        // the states would alternate forever without time passing
+        if (parameters.meanBurstLength + parameters.meanQuietLength <= 0)
+            throw cRuntimeError(owner, "meanBurstLength and meanQuietLength must not both be zero");
+    }
+    if (parameters.kind == DIURNAL) {
+        parameters.hourlyRates = cStringTokenizer(owner->par("diurnalProfile").stringValue()).asDoubleVector();
+        if (parameters.hourlyRates.size() != 24)
+            throw cRuntimeError(owner, "diurnalProfile must have 24 hourly values, got %d", (int)parameters.hourlyRates.size());
+        double sum = 0;
+        for (double rate : parameters.hourlyRates) {
+            if (rate < 0)
+                throw cRuntimeError(owner, "diurnalProfile values must not be negative");
+            sum += rate;
+        }
+        if (sum <= 0)
+            throw cRuntimeError(owner, "diurnalProfile must have a positive value");
+        for (double& rate : parameters.hourlyRates)
+            rate *= 24 / sum;
+    }
+    return parameters;
+}
+
+simtime_t TrafficModel::nextInterval(simtime_t now, simtime_t minInterval)
+{
+    switch (parameters.kind) {
+        case PERIODIC: {
+            double jitter = parameters.meanInterval.dbl() * parameters.jitterFraction;
+            simtime_t interval = parameters.meanInterval + (jitter > 0 ? uniform(rng, -jitter, jitter) : 0);
+            return std::max(interval, minInterval);
+        }
+        case EXPONENTIAL:
+            return drawExponential(minInterval);
+        case MMPP:
+            return drawMmpp(now + minInterval) - now;
+        case DIURNAL:
+            return drawDiurnal(now + minInterval) - now;
+    }
+    throw cRuntimeError("Unknown traffic model");
+}
+
+simtime_t TrafficModel::drawExponential(simtime_t minInterval) const
+{
+    // inversion of the exponential truncated to [minInterval, maxInterval];
+    // being memoryless, the lower truncation is a plain shift
+    double mean = parameters.meanInterval.dbl();
+    double u = uniform(rng, 0, 1);
+    if (parameters.maxInterval >= 0) {
+        // e.g. a cap below the airtime the duty cycle requires at SF12
+        if (parameters.maxInterval < minInterval)
+            throw cRuntimeError("maxInterval %s is below the minimum packet interval %s", parameters.maxInterval.str().c_str(), minInterval.str().c_str());
+        u *= 1 - exp(-(parameters.maxInterval - minInterval).dbl() / mean);
+    }
+    return minInterval - mean * log1p(-u);
+}
+
+simtime_t TrafficModel::drawMmpp(simtime_t start)
+{
+    // the quiet state takes quiet / (quiet + burst) of the time, so this
+    // quiet rate gives a long-run rate of 1 / meanInterval
+    double quiet = parameters.meanQuietLength.dbl();
+    double burst = parameters.meanBurstLength.dbl();
+    double quietRate = (quiet + burst) / (parameters.meanInterval.dbl() * (quiet + burst * parameters.burstRateFactor));
+    simtime_t time = start;
+    if (stateEnd < 0)
+        stateEnd = time + exponential(rng, parameters.meanQuietLength.dbl());
+    while (true) {
+        // the state may have changed since the last packet
+        if (time >= stateEnd) {
+            inBurst = !inBurst;
+            stateEnd += exponential(rng, (inBurst ? parameters.meanBurstLength : parameters.meanQuietLength).dbl());
+            continue;
+        }
+        double rate = inBurst ? quietRate * parameters.burstRateFactor : quietRate;
+        simtime_t arrival = time + exponential(rng, 1 / rate);
+        if (arrival < stateEnd)
+            return arrival;
+        time = stateEnd;
+    }
+}
+
+simtime_t TrafficModel::drawDiurnal(simtime_t start) const
+{
+    // inversion of the cumulative rate, which is piecewise linear over the hours
+    double baseRate = 1 / parameters.meanInterval.dbl();
+    double remaining = exponential(rng, 1.0);
+    double time = start.dbl();
+    while (true) {
+        double hourEnd = (std::floor(time / 3600) + 1) * 3600;
+        double rate = baseRate * parameters.hourlyRates[(long)std::floor(time / 3600) % 24];
+        double mass = rate * (hourEnd - time);
+        if (remaining < mass)
+            return time + remaining / rate;
+        remaining -= mass;
+        time = hourEnd;
+    }
+}
+
+} // namespace flora
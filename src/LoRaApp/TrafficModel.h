@@ -0,0 +1,88 @@
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+// 
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see http://www.gnu.org/licenses/.
+// 
+
+#ifndef LORAAPP_TRAFFICMODEL_H_
+#define LORAAPP_TRAFFICMODEL_H_
+
+#include <vector>
+
+#include "inet/common/INETDefs.h"
+
+namespace flora {
+
+using namespace inet;
+
+/**
+ * Inter-arrival times of application packets, shared by the LoRa apps. Every
+ * interval costs a single draw (plus one per state change for MMPP and per
+ * hour for the diurnal profile), no rejection sampling. The apps configure it
+ * from their NED parameters with readParameters():
+ *  - trafficModel: "periodic", "exponential", "mmpp" or "diurnal"
+ *  - intervalJitterFraction: periodic jitter as a fraction of the mean
+ *  - maxInterval: upper truncation of the exponential, negative for none; an
+ *    error if below the minimum interval of a draw
+ *  - burstRateFactor, meanBurstLength, meanQuietLength: two-state MMPP whose
+ *    rate is burstRateFactor times higher during bursts; the quiet rate is
+ *    chosen so that the long-run mean interval is still the mean interval
+ *  - diurnalProfile: 24 relative hourly rates of a non-homogeneous Poisson
+ *    process
+ */
+class TrafficModel
+{
+  public:
+    enum Kind { PERIODIC, EXPONENTIAL, MMPP, DIURNAL };
+
+    struct Parameters
+    {
+        Kind kind = EXPONENTIAL;
+        simtime_t meanInterval;
+        double jitterFraction = 0;
+        simtime_t maxInterval = -1;
+        double burstRateFactor = 1;
+        simtime_t meanBurstLength;
+        simtime_t meanQuietLength;
+        /** Rate per hour of the day relative to 1 / meanInterval, averaging 1 */
+        std::vector<double> hourlyRates;
+    };
+
+  protected:
+    cRNG *rng = nullptr;
+    Parameters parameters;
+    /** MMPP state */
+    bool inBurst = false;
+    simtime_t stateEnd = -1;
+
+  protected:
+    simtime_t drawExponential(simtime_t minInterval) const;
+    simtime_t drawMmpp(simtime_t start);
+    simtime_t drawDiurnal(simtime_t start) const;
+
+  public:
+    TrafficModel() {}
+    TrafficModel(cRNG *rng, const Parameters& parameters) : rng(rng), parameters(parameters) {}
+
+    /** Reads the traffic model parameters of the owner module, see above */
+    static Parameters readParameters(cComponent *owner, simtime_t meanInterval);
+
+    /**
+     * Time from now to the next packet, at least minInterval (e.g. to keep
+     * the duty cycle): the arrival process is observed from now + minInterval.
+     */
+    simtime_t nextInterval(simtime_t now, simtime_t minInterval = 0);
+};
+
+} // namespace flora
+
+#endif /* LORAAPP_TRAFFICMODEL_H_ */
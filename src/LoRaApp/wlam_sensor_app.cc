@@ -1,4 +1,8 @@
 #include "wlam_sensor_app.h"
+#include "LoRa/LoRaSFAssigner.h"
+#include "inet/common/ModuleAccess.h"
+#include "inet/mobility/contract/IMobility.h"
+#include "LoRaAppPacket_m.h"
 
 namespace flora {
 
@@ -12,7 +16,6 @@ void wlam_sensor_app::initialize(int stage)
         double nInt  = par("no2Interval").doubleValue();
         double hInt  = par("humidityInterval").doubleValue();
         double cInt  = par("counterInterval").doubleValue();
-        jitterFrac   = par("intervalJitterFraction").doubleValue();
 
         // Environment model parameters
         baseTemp = par("baseTemperature").doubleValue();
@@ -28,6 +31,12 @@ void wlam_sensor_app::initialize(int stage)
         initSF    = par("initialLoRaSF").intValue();
         initBWHZ  = par("initialLoRaBW").doubleValue();
         initCR    = par("initialLoRaCR").intValue();
+        confirmedUplinks = par("confirmedUplinks").boolValue();
+        evaluateADRinNode = par("evaluateADRinNode").boolValue();
+        adrAckLimit = par("adrAckLimit").intValue();
+        adrAckDelay = par("adrAckDelay").intValue();
+        sfVector.setName("SF Vector");
+        tpVector.setName("TP Vector");
 
         basePayloadBytes = par("basePayloadBytes").intValue();
 
@@ -51,8 +60,26 @@ void wlam_sensor_app::initialize(int stage)
         initSensor(SID_HUMIDITY,   hInt, false);
         initSensor(SID_COUNTER,    cInt, true);
 
+        sendOnDelta = par("sendOnDelta").boolValue();
+        maxSilence = par("maxSilenceInterval");
+        sensors[SID_TEMPERATURE].deadband = par("temperatureDelta").doubleValue();
+        sensors[SID_NO2].deadband         = par("no2Delta").doubleValue();
+        sensors[SID_HUMIDITY].deadband    = par("humidityDelta").doubleValue();
+        sensors[SID_COUNTER].deadband     = par("counterDelta").doubleValue();
+
         scheduler = new cMessage("sensorScheduler");
     } else if (stage == INITSTAGE_APPLICATION_LAYER) {
+        if (*par("environmentModule").stringValue()) {
+            environment = getModuleFromPar<EnvironmentField>(par("environmentModule"), this);
+            // the nodes are stationary
+            position = check_and_cast<IMobility *>(getContainingNode(this)->getSubmodule("mobility"))->getCurrentPosition();
+        }
+        if (*par("trafficTraceModule").stringValue()) {
+            traceDriven = true;
+            traceCursor = getModuleFromPar<SensorTrace>(par("trafficTraceModule"), this)->getEntries(getContainingNode(this)->getIndex());
+            while (traceCursor.first != traceCursor.second && traceCursor.first->time < simTime())
+                traceCursor.first++;
+        }
         applyInitialLoRaParams();
         scheduleNext();
     }
@@ -68,6 +95,63 @@ void wlam_sensor_app::applyInitialLoRaParams()
     loRaRadio->loRaSF = initSF;
     loRaRadio->loRaBW = Hz(initBWHZ);
     loRaRadio->loRaCR = initCR;
+
+    const char *sfAssignerModule = par("sfAssignerModule");
+    if (*sfAssignerModule) {
+        int sf = initSF;
+        double tpdBm = initTPdBm;
+        getModuleFromPar<LoRaSFAssigner>(par("sfAssignerModule"), this)->getAssignment(loRaRadio, sf, tpdBm);
+        loRaRadio->loRaSF = sf;
+        loRaRadio->loRaTP = tpdBm;
+    }
+    recordTxConfig();
+}
+
+void wlam_sensor_app::recordTxConfig()
+{
+    // recorded when set, not per uplink, as they change rarely
+    sfVector.record(loRaRadio->loRaSF);
+    tpVector.record(loRaRadio->loRaTP);
+}
+
+void wlam_sensor_app::handleDownlink(Packet *pkt)
+{
+    // any downlink shows that the network still hears the node
+    adrAckCnt = 0;
+    if (!evaluateADRinNode || !loRaRadio || pkt->getDataLength() == b(0))
+        return;
+    auto command = dynamicPtrCast<const LoRaAppPacket>(pkt->peekAtFront<Chunk>());
+    if (command == nullptr || command->getMsgType() != TXCONFIG)
+        return;
+    numADRCommands++;
+    const auto& options = command->getOptions();
+    if (options.getLoRaTP() != -1)
+        loRaRadio->loRaTP = options.getLoRaTP();
+    if (options.getLoRaSF() != -1)
+        loRaRadio->loRaSF = options.getLoRaSF();
+    EV_DETAIL << "ADR command: SF " << loRaRadio->loRaSF << ", TP " << loRaRadio->loRaTP << " dBm" << endl;
+    recordTxConfig();
+}
+
+void wlam_sensor_app::updateADRAckCounter(const Ptr<LoRaSensorPacket>& payload)
+{
+    // LoRaWAN ADR back-off: ADRACKReq after adrAckLimit uplinks without a
+    // downlink, then every adrAckDelay uplinks first the default TP, then
+    // one SF up at a time
+    adrAckCnt++;
+    if (adrAckCnt < adrAckLimit)
+        return;
+    payload->setADRACKReq(true);
+    if (adrAckCnt < adrAckLimit + adrAckDelay || (adrAckCnt - adrAckLimit) % adrAckDelay != 0)
+        return;
+    if (loRaRadio->loRaTP < initTPdBm)
+        loRaRadio->loRaTP = initTPdBm;
+    else if (loRaRadio->loRaSF < 12)
+        loRaRadio->loRaSF++;
+    else
+        return;
+    numADRBackoffSteps++;
+    recordTxConfig();
 }
 
 void wlam_sensor_app::initSensor(SensorID id, double interval, bool isCounter)
@@ -79,8 +163,8 @@ void wlam_sensor_app::initSensor(SensorID id, double interval, bool isCounter)
     sensors[id].counter   = 0;
 
     if (interval > 0) {
-        double jitter = interval * jitterFrac;
-        sensors[id].nextDue = simTime() + interval + uniform(-jitter, jitter);
+        sensors[id].traffic = TrafficModel(getRNG(0), TrafficModel::readParameters(this, interval));
+        sensors[id].nextDue = simTime() + sensors[id].traffic.nextInterval(simTime());
     } else {
         sensors[id].nextDue = SIMTIME_MAX;
     }
@@ -97,6 +181,11 @@ simtime_t wlam_sensor_app::earliestNextDue() const
 
 void wlam_sensor_app::scheduleNext()
 {
+    if (traceDriven) {
+        if (traceCursor.first != traceCursor.second)
+            scheduleAt(traceCursor.first->time, scheduler);
+        return;
+    }
     simtime_t n = earliestNextDue();
     if (n < SIMTIME_MAX)
         scheduleAt(n, scheduler);
@@ -104,18 +193,24 @@ void wlam_sensor_app::scheduleNext()
 
 double wlam_sensor_app::genTemperature()
 {
+    if (environment)
+        return environment->sample(EnvironmentField::TEMPERATURE, position) + normal(0, 0.2);
     double hrs = simTime().dbl() / 3600.0;
     return baseTemp + ampTemp * sin(2 * M_PI * (hrs / 24.0)) + normal(0, 0.2);
 }
 
 double wlam_sensor_app::genHumidity()
 {
+    if (environment)
+        return environment->sample(EnvironmentField::HUMIDITY, position) + normal(0, 0.5);
     double hrs = simTime().dbl() / 3600.0;
     return baseHum + ampHum * sin(2 * M_PI * (hrs / 24.0) + M_PI / 4) + normal(0, 0.5);
 }
 
 double wlam_sensor_app::genNO2()
 {
+    if (environment)
+        return environment->sample(EnvironmentField::NO2, position) + normal(0, 0.1);
     double hrs = simTime().dbl() / 3600.0;
     return baseNO2 + ampNO2 * (0.5 + 0.5 * sin(2 * M_PI * (hrs / 12.0))) + normal(0, 0.1);
 }
@@ -129,6 +224,7 @@ void wlam_sensor_app::attachLoRaTag(Packet *pkt)
     tag->setCenterFrequency(loRaRadio->loRaCF);
     tag->setPower(mW(math::dBmW2mW(loRaRadio->loRaTP)));
     tag->setCodeRendundance(loRaRadio->loRaCR);
+    tag->setConfirmed(confirmedUplinks);
 }
 
 void wlam_sensor_app::sampleAndSendIfDue()
@@ -146,33 +242,48 @@ void wlam_sensor_app::sampleAndSendIfDue()
         if (s.nextDue <= now) {
             switch (s.id) {
                 case SID_TEMPERATURE: {
-                    temperature = genTemperature();
-                    humidity    = genHumidity();
-                    emit(sigTemp, temperature);
-                    emit(sigHum, humidity);
-                    bitmap |= SB_TEMPERATURE;
-                    bitmap |= SB_HUMIDITY;
+                    // humidity is read along with the temperature
+                    double t = genTemperature();
+                    double h = genHumidity();
+                    emit(sigTemp, t);
+                    emit(sigHum, h);
+                    if (isWorthSending(s, t)) {
+                        temperature = t;
+                        bitmap |= SB_TEMPERATURE;
+                    }
+                    if (isWorthSending(sensors[SID_HUMIDITY], h)) {
+                        humidity = h;
+                        bitmap |= SB_HUMIDITY;
+                    }
                     break;
                 }
                 case SID_NO2: {
-                    no2 = genNO2();
-                    s.lastValue = no2;
-                    emit(sigNO2, no2);
-                    bitmap |= SB_NO2;
+                    double n = genNO2();
+                    s.lastValue = n;
+                    emit(sigNO2, n);
+                    if (isWorthSending(s, n)) {
+                        no2 = n;
+                        bitmap |= SB_NO2;
+                    }
                     break;
                 }
                 case SID_HUMIDITY: {
-                    humidity = genHumidity();
-                    s.lastValue = humidity;
-                    emit(sigHum, humidity);
-                    bitmap |= SB_HUMIDITY;
+                    double h = genHumidity();
+                    s.lastValue = h;
+                    emit(sigHum, h);
+                    if (isWorthSending(s, h)) {
+                        humidity = h;
+                        bitmap |= SB_HUMIDITY;
+                    }
                     break;
                 }
                 case SID_COUNTER: {
                     s.counter++;
-                    counterVal = s.counter;
-                    emit(sigCounter, (long)counterVal);
-                    bitmap |= SB_COUNTER;
+                    emit(sigCounter, (long)s.counter);
+                    if (isWorthSending(s, s.counter)) {
+                        counterVal = s.counter;
+                        bitmap |= SB_COUNTER;
+                    }
                     break;
                 }
                 default:
@@ -180,8 +291,7 @@ void wlam_sensor_app::sampleAndSendIfDue()
             }
 
             if (s.interval > 0) {
-                double jitter = s.interval.dbl() * jitterFrac;
-                s.nextDue = now + s.interval + uniform(-jitter, jitter);
+                s.nextDue = now + s.traffic.nextInterval(now);
             }
             else {
                 s.nextDue = SIMTIME_MAX;
@@ -191,7 +301,24 @@ void wlam_sensor_app::sampleAndSendIfDue()
 
     if (bitmap == SB_NONE)
         return;
+    sendUplink(bitmap, temperature, humidity, no2, counterVal);
+}
 
+void wlam_sensor_app::sendTraceEntriesDue()
+{
+    for (; traceCursor.first != traceCursor.second && traceCursor.first->time <= simTime(); traceCursor.first++) {
+        const SensorTraceEntry& entry = *traceCursor.first;
+        if (entry.bitmap & SB_TEMPERATURE) emit(sigTemp, (double)entry.temperature);
+        if (entry.bitmap & SB_NO2)         emit(sigNO2, (double)entry.no2);
+        if (entry.bitmap & SB_HUMIDITY)    emit(sigHum, (double)entry.humidity);
+        if (entry.bitmap & SB_COUNTER)     emit(sigCounter, (long)entry.counter);
+        sendUplink(entry.bitmap, entry.temperature, entry.humidity, entry.no2, entry.counter);
+    }
+}
+
+void wlam_sensor_app::sendUplink(int bitmap, double temperature, double humidity, double no2, int counterVal)
+{
+    simtime_t now = simTime();
     auto pkt = new Packet("sensorAggUplink");
     auto payload = makeShared<LoRaSensorPacket>();
 
@@ -211,22 +338,45 @@ void wlam_sensor_app::sampleAndSendIfDue()
     if (bitmap & SB_COUNTER)     bytes += par("counterPayloadBytes").intValue();
 
     payload->setChunkLength(B(bytes));
+    if (evaluateADRinNode && loRaRadio)
+        updateADRAckCounter(payload);
 
     pkt->insertAtBack(payload);
     attachLoRaTag(pkt);
     send(pkt, "socketOut");
 
-    emit(sigPktSent, (long)bitmap);
+    // listeners (e.g. NetworkServerApp) count the uplinks per SF
+    emit(sigPktSent, (long)(loRaRadio ? loRaRadio->loRaSF : initSF));
+}
+
+bool wlam_sensor_app::isWorthSending(SensorState& s, double value)
+{
+    s.numSamples++;
+    simtime_t now = simTime();
+    bool send = !sendOnDelta || std::isnan(s.lastSentValue) || std::fabs(value - s.lastSentValue) >= s.deadband
+            || now - s.lastSentTime >= maxSilence;
+    if (send) {
+        s.lastSentValue = value;
+        s.lastSentTime = now;
+    }
+    else
+        s.numSuppressed++;
+    if (sendOnDelta)
+        s.reconstructionError.collect(std::fabs(value - s.lastSentValue));
+    return send;
 }
 
 void wlam_sensor_app::handleMessage(cMessage *msg)
 {
     if (msg == scheduler) {
-        sampleAndSendIfDue();
+        if (traceDriven)
+            sendTraceEntriesDue();
+        else
+            sampleAndSendIfDue();
         scheduleNext();
     }
     else if (msg->arrivedOn("socketIn")) {
-        // Ignoring downlink packets for now
+        handleDownlink(check_and_cast<Packet *>(msg));
         delete msg;
     }
     else {
@@ -240,6 +390,23 @@ void wlam_sensor_app::finish()
         cancelAndDelete(scheduler);
         scheduler = nullptr;
     }
+    if (loRaRadio) {
+        recordScalar("finalSF", loRaRadio->loRaSF);
+        recordScalar("finalTP", loRaRadio->loRaTP);
+    }
+    if (sendOnDelta) {
+        static const char *sensorNames[SID_COUNT] = { "temperature", "no2", "humidity", "counter" };
+        for (int i = 0; i < SID_COUNT; ++i) {
+            std::string name = sensorNames[i];
+            recordScalar((name + " samples").c_str(), sensors[i].numSamples);
+            recordScalar((name + " suppressed").c_str(), sensors[i].numSuppressed);
+            sensors[i].reconstructionError.recordAs((name + " reconstructionError").c_str());
+        }
+    }
+    if (evaluateADRinNode) {
+        recordScalar("receivedADRCommands", numADRCommands);
+        recordScalar("numADRBackoffSteps", numADRBackoffSteps);
+    }
 }
 
 } // namespace flora
@@ -9,6 +9,9 @@
 #include "LoRa/LoRaRadio.h"
 #include "LoRa/LoRaTagInfo_m.h"
 #include "DataPacket_m.h"
+#include "EnvironmentField.h"
+#include "SensorTrace.h"
+#include "TrafficModel.h"
 #include "inet/common/Units.h"
 
 using namespace omnetpp;
@@ -25,6 +28,16 @@ struct SensorState {
     double     lastValue = NAN;
     int        counter = 0;    // simple int
     bool       isCounter = false;
+    TrafficModel traffic;   // sampling intervals
+
+    // send-on-delta: a sample is only sent when it moved by deadband since
+    // the last sent value, or when the sensor was silent for maxSilence
+    double     deadband = 0;
+    double     lastSentValue = NAN;
+    simtime_t  lastSentTime = 0;
+    long       numSamples = 0;
+    long       numSuppressed = 0;
+    cStdDev    reconstructionError;   // |sample - last sent value| per sample, as the server holds the last value
 };
 
 class wlam_sensor_app : public cSimpleModule, public ILifecycle
@@ -32,12 +45,17 @@ class wlam_sensor_app : public cSimpleModule, public ILifecycle
   private:
     cMessage *scheduler = nullptr;
     SensorState sensors[SID_COUNT];
-    double jitterFrac = 0.0;
 
     // Environment generation params
     double baseTemp = 0, ampTemp = 0;
     double baseNO2 = 0, ampNO2 = 0;
     double baseHum = 0, ampHum = 0;
+    /** Shared field the values are sampled from instead, if any */
+    EnvironmentField *environment = nullptr;
+    Coord position;
+    /** Remaining recorded uplinks when the traffic is trace driven */
+    bool traceDriven = false;
+    SensorTrace::Range traceCursor;
 
     // Initial LoRa params
     double initTPdBm = 0;
@@ -46,9 +64,23 @@ class wlam_sensor_app : public cSimpleModule, public ILifecycle
     double initBWHZ  = 0;
     int    initCR    = 0;
     bool   initUseHeader = true;
+    bool   confirmedUplinks = false;
 
     int basePayloadBytes = 0;
 
+    bool sendOnDelta = false;
+    simtime_t maxSilence;
+
+    // ADR: TXCONFIG downlinks set SF and TP, ADRACKReq back-off as in LoRaWAN
+    bool evaluateADRinNode = true;
+    int adrAckLimit = 64;
+    int adrAckDelay = 32;
+    int adrAckCnt = 0;
+    long numADRCommands = 0;
+    long numADRBackoffSteps = 0;
+    cOutVector sfVector;
+    cOutVector tpVector;
+
     // Signals
     simsignal_t sigTemp;
     simsignal_t sigNO2;
@@ -69,12 +101,18 @@ class wlam_sensor_app : public cSimpleModule, public ILifecycle
     simtime_t earliestNextDue() const;
     void scheduleNext();
     void sampleAndSendIfDue();
+    void sendTraceEntriesDue();
+    void sendUplink(int bitmap, double temperature, double humidity, double no2, int counterVal);
+    bool isWorthSending(SensorState& s, double value);
 
     double genTemperature();
     double genNO2();
     double genHumidity();
 
     void applyInitialLoRaParams();
+    void handleDownlink(Packet *pkt);
+    void updateADRAckCounter(const Ptr<LoRaSensorPacket>& payload);
+    void recordTxConfig();
     void attachLoRaTag(Packet *pkt);
 
   public:
@@ -32,6 +32,7 @@ public:
     virtual W getPowerConsumption() const override;
     bool readConfigurationFile();
     virtual void receiveSignal(cComponent *source, simsignal_t signal, intval_t value, cObject *details) override;
+    double getTotalEnergyConsumed() const { return totalEnergyConsumed; }
 
 protected:
     int energyConsumerId;
@@ -0,0 +1,56 @@
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see http://www.gnu.org/licenses/.
+//
+
+#ifndef LORAPHY_ILORAARRIVALHANDLER_H_
+#define LORAPHY_ILORAARRIVALHANDLER_H_
+
+#include "inet/physicallayer/wireless/common/contract/packetlevel/IRadioSignal.h"
+#include "inet/physicallayer/wireless/common/contract/packetlevel/ITransmission.h"
+
+using namespace inet;
+using namespace inet::physicallayer;
+
+namespace flora {
+
+/**
+ * Callback interface used by LoRaMedium when direct signal delivery is
+ * enabled. Instead of receiving one WirelessSignal message per transmission,
+ * the radio is notified by the medium when the arrival bucket containing its
+ * arrival is processed. The radio decides itself whether the arrival is worth
+ * a reception timer (e.g. sleeping end nodes simply ignore it).
+ */
+class ILoRaArrivalHandler
+{
+  public:
+    /**
+     * Message kind of a reception timer waiting for the start of an arrival
+     * delivered ahead of time. Reception timers otherwise carry their signal
+     * part as kind; negative kinds are reserved by OMNeT++.
+     */
+    static const short PENDING_ARRIVAL_KIND = IRadioSignal::SIGNAL_PART_DATA + 1;
+
+  public:
+    virtual ~ILoRaArrivalHandler() {}
+
+    /**
+     * Called in the context of the medium at or before the arrival start
+     * time of the transmission at this radio.
+     */
+    virtual void handleArrival(const ITransmission *transmission) = 0;
+};
+
+} // namespace flora
+
+#endif /* LORAPHY_ILORAARRIVALHANDLER_H_ */
@@ -0,0 +1,41 @@
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see http://www.gnu.org/licenses/.
+//
+
+#ifndef LORAPHY_ILORAMEANPATHLOSS_H_
+#define LORAPHY_ILORAMEANPATHLOSS_H_
+
+#include "inet/common/Units.h"
+
+using namespace inet;
+
+namespace flora {
+
+/**
+ * Implemented by the path loss models with a random shadowing term. Lets
+ * LoRaMedium estimate a received power, e.g. for channel activity detection,
+ * without drawing from the shadowing RNG of the actual receptions.
+ */
+class ILoRaMeanPathLoss
+{
+  public:
+    virtual ~ILoRaMeanPathLoss() {}
+
+    /** Path loss as a fraction like computePathLoss(), without shadowing */
+    virtual double computeMeanPathLoss(mps propagationSpeed, Hz frequency, m distance) const = 0;
+};
+
+} // namespace flora
+
+#endif /* LORAPHY_ILORAMEANPATHLOSS_H_ */
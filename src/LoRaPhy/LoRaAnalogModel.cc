@@ -26,9 +26,26 @@ namespace flora {
 
 Define_Module(LoRaAnalogModel);
 
+void LoRaAnalogModel::initialize(int stage)
+{
+    ScalarAnalogModelBase::initialize(stage);
+    if (stage == INITSTAGE_LOCAL) {
+        auto fadingType = LoRaFadingTable::parseType(par("fading"));
+        double fadingParameter = 0;
+        if (fadingType == LoRaFadingTable::FADING_RICIAN)
+            fadingParameter = math::dB2fraction(par("ricianK"));
+        else if (fadingType == LoRaFadingTable::FADING_NAKAGAMI)
+            fadingParameter = par("nakagamiM");
+        fadingTable.build(fadingType, fadingParameter, par("fadingTableSize"));
+    }
+}
+
 std::ostream& LoRaAnalogModel::printToStream(std::ostream& stream, int level, int evFlags) const
 {
-    return stream << "LoRaAnalogModel";
+    stream << "LoRaAnalogModel";
+    if (level <= PRINT_LEVEL_TRACE)
+        stream << ", fading = " << par("fading").stringValue();
+    return stream;
 }
 
 const W LoRaAnalogModel::getBackgroundNoisePower(const LoRaBandListening *listening) const {
@@ -113,6 +130,9 @@ const IReception *LoRaAnalogModel::computeReception(const IRadio *receiverRadio,
     const Coord receptionStartPosition = arrival->getStartPosition();
     const Coord receptionEndPosition = arrival->getEndPosition();
     W receivedPower = computeReceptionPower(receiverRadio, transmission, arrival);
+    // one block fading realisation per reception, shared by all of its signal parts
+    if (fadingTable.isEnabled())
+        receivedPower = receivedPower * fadingTable.getGain(uniform(0, 1));
     Hz LoRaCF = loRaTransmission->getLoRaCF();
     int LoRaSF = loRaTransmission->getLoRaSF();
     Hz LoRaBW = loRaTransmission->getLoRaBW();
@@ -21,11 +21,18 @@
 #include "inet/physicallayer/wireless/common/analogmodel/packetlevel/ScalarNoise.h"
 
 #include "LoRaBandListening.h"
+#include "LoRaFadingTable.h"
 
 namespace flora {
 
 class LoRaAnalogModel : public ScalarAnalogModelBase
 {
+  protected:
+    LoRaFadingTable fadingTable;
+
+  protected:
+    virtual void initialize(int stage) override;
+
   public:
     const W getBackgroundNoisePower(const LoRaBandListening *listening) const;
     virtual std::ostream& printToStream(std::ostream& stream, int level, int evFlags = 0) const override;
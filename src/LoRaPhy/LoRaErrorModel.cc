@@ -0,0 +1,126 @@
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+// 
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see http://www.gnu.org/licenses/.
+// 
+
+#include "LoRaErrorModel.h"
+#include "LoRaModulation.h"
+#include "LoRaTransmission.h"
+#include "inet/physicallayer/wireless/common/contract/packetlevel/IReception.h"
+
+namespace flora {
+
+Define_Module(LoRaErrorModel);
+
+void LoRaErrorModel::initialize(int stage)
+{
+    ErrorModelBase::initialize(stage);
+    if (stage == INITSTAGE_LOCAL) {
+        minSnir = par("minSnir");
+        double maxSnir = par("maxSnir");
+        snirResolution = par("snirResolution");
+        if (snirResolution <= 0 || maxSnir <= minSnir)
+            throw cRuntimeError("Invalid SNIR grid: [%g dB, %g dB] with resolution %g dB", minSnir, maxSnir, snirResolution);
+        numSnirPoints = (int)std::ceil((maxSnir - minSnir) / snirResolution) + 1;
+        for (int sfIndex = 0; sfIndex < numSF; sfIndex++) {
+            int spreadFactor = minSF + sfIndex;
+            bitErrorRates[sfIndex].resize(numSnirPoints);
+            symbolErrorRates[sfIndex].resize(numSnirPoints);
+            for (int cr = 1; cr <= numCR; cr++)
+                codewordErrorRates[sfIndex][cr - 1].resize(numSnirPoints);
+            for (int i = 0; i < numSnirPoints; i++) {
+                double snir = math::dB2fraction(minSnir + i * snirResolution);
+                double ber = LoRaModulation::computeChirpBitErrorRate(snir, spreadFactor);
+                bitErrorRates[sfIndex][i] = ber;
+                symbolErrorRates[sfIndex][i] = LoRaModulation::computeChirpSymbolErrorRate(snir, spreadFactor);
+                for (int cr = 1; cr <= numCR; cr++) {
+                    // 4/5 and 4/6 only detect errors, 4/7 and 4/8 correct a single bit error per codeword
+                    int n = 4 + cr;
+                    double cwer = 1 - std::pow(1 - ber, n);
+                    if (cr >= 3)
+                        cwer -= n * ber * std::pow(1 - ber, n - 1);
+                    codewordErrorRates[sfIndex][cr - 1][i] = std::max(0.0, cwer);
+                }
+            }
+        }
+    }
+}
+
+std::ostream& LoRaErrorModel::printToStream(std::ostream& stream, int level, int evFlags) const
+{
+    stream << "LoRaErrorModel";
+    if (level <= PRINT_LEVEL_TRACE)
+        stream << ", minSnir = " << minSnir << " dB"
+               << ", snirResolution = " << snirResolution << " dB"
+               << ", numSnirPoints = " << numSnirPoints;
+    return stream;
+}
+
+double LoRaErrorModel::lookup(const std::vector<double>& table, double snir) const
+{
+    if (!(snir > 0))
+        return table.front();
+    double position = (math::fraction2dB(snir) - minSnir) / snirResolution;
+    if (position <= 0)
+        return table.front();
+    if (position >= numSnirPoints - 1)
+        return table.back();
+    int index = (int)position;
+    double alpha = position - index;
+    return table[index] + alpha * (table[index + 1] - table[index]);
+}
+
+int LoRaErrorModel::getSFIndex(const ISnir *snir) const
+{
+    auto transmission = check_and_cast<const LoRaTransmission *>(snir->getReception()->getTransmission());
+    int spreadFactor = transmission->getLoRaSF();
+    if (spreadFactor < minSF || spreadFactor > maxSF)
+        throw cRuntimeError("Unsupported spreading factor %d", spreadFactor);
+    return spreadFactor - minSF;
+}
+
+double LoRaErrorModel::computeCodewordErrorRate(double snir, int spreadFactor, int codeRate) const
+{
+    if (spreadFactor < minSF || spreadFactor > maxSF)
+        throw cRuntimeError("Unsupported spreading factor %d", spreadFactor);
+    if (codeRate < 1 || codeRate > numCR)
+        throw cRuntimeError("Unsupported code rate 4/%d", 4 + codeRate);
+    return lookup(codewordErrorRates[spreadFactor - minSF][codeRate - 1], snir);
+}
+
+double LoRaErrorModel::computePacketErrorRate(const ISnir *snir, IRadioSignal::SignalPart part) const
+{
+    Enter_Method_Silent();
+    auto transmission = check_and_cast<const LoRaTransmission *>(snir->getReception()->getTransmission());
+    double cwer = computeCodewordErrorRate(snir->getMin(), transmission->getLoRaSF(), transmission->getLoRaCR());
+    if (cwer == 0)
+        return 0;
+    // every byte is carried by two codewords
+    b length = transmission->getPacket()->getDataLength();
+    double numCodewords = std::ceil(length.get() / 4.0);
+    return 1 - std::pow(1 - cwer, numCodewords);
+}
+
+double LoRaErrorModel::computeBitErrorRate(const ISnir *snir, IRadioSignal::SignalPart part) const
+{
+    Enter_Method_Silent();
+    return lookup(bitErrorRates[getSFIndex(snir)], snir->getMin());
+}
+
+double LoRaErrorModel::computeSymbolErrorRate(const ISnir *snir, IRadioSignal::SignalPart part) const
+{
+    Enter_Method_Silent();
+    return lookup(symbolErrorRates[getSFIndex(snir)], snir->getMin());
+}
+
+} // namespace flora
@@ -0,0 +1,70 @@
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+// 
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see http://www.gnu.org/licenses/.
+// 
+
+#ifndef LORAPHY_LORAERRORMODEL_H_
+#define LORAPHY_LORAERRORMODEL_H_
+
+#include "inet/physicallayer/wireless/common/base/packetlevel/ErrorModelBase.h"
+#include <vector>
+
+using namespace inet;
+using namespace inet::physicallayer;
+
+namespace flora {
+
+/**
+ * Chirp spread spectrum error model with precomputed lookup tables.
+ *
+ * The tables are filled once in initialize() from the closed form
+ * approximations in LoRaModulation and are linearly interpolated in dB, so
+ * a lookup costs two array reads regardless of SF and CR.
+ */
+class LoRaErrorModel : public ErrorModelBase
+{
+  protected:
+    static const int minSF = 7;
+    static const int maxSF = 12;
+    static const int numSF = maxSF - minSF + 1;
+    static const int numCR = 4;
+
+    double minSnir = NaN;    // dB
+    double snirResolution = NaN;    // dB
+    int numSnirPoints = 0;
+
+    std::vector<double> bitErrorRates[numSF];
+    std::vector<double> symbolErrorRates[numSF];
+    /** Probability that a (4 + CR) bit Hamming codeword is not decoded correctly */
+    std::vector<double> codewordErrorRates[numSF][numCR];
+
+  protected:
+    virtual void initialize(int stage) override;
+
+    virtual double lookup(const std::vector<double>& table, double snir) const;
+    virtual int getSFIndex(const ISnir *snir) const;
+
+  public:
+    virtual std::ostream& printToStream(std::ostream& stream, int level, int evFlags = 0) const override;
+
+    virtual double computePacketErrorRate(const ISnir *snir, IRadioSignal::SignalPart part) const override;
+    virtual double computeBitErrorRate(const ISnir *snir, IRadioSignal::SignalPart part) const override;
+    virtual double computeSymbolErrorRate(const ISnir *snir, IRadioSignal::SignalPart part) const override;
+
+    /** Codeword error rate for a linear SNIR, interpolated from the tables */
+    virtual double computeCodewordErrorRate(double snir, int spreadFactor, int codeRate) const;
+};
+
+} // namespace flora
+
+#endif /* LORAPHY_LORAERRORMODEL_H_ */
@@ -0,0 +1,128 @@
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+// 
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see http://www.gnu.org/licenses/.
+// 
+
+#include "LoRaFadingTable.h"
+#include <omnetpp.h>
+#include <cmath>
+
+using namespace omnetpp;
+
+namespace flora {
+
+// exp(-z) * I0(z), kept finite for the large arguments of strong line of sight components
+static double scaledBesselI0(double z)
+{
+    if (z < 20) {
+        // power series, at most a few dozen terms in this range
+        double term = 1, sum = 1, q = z * z / 4;
+        for (int k = 1; term > 1e-12 * sum; k++) {
+            term *= q / ((double)k * k);
+            sum += term;
+        }
+        return sum * std::exp(-z);
+    }
+    return (1 + 1 / (8 * z) + 9 / (128 * z * z)) / std::sqrt(2 * M_PI * z);
+}
+
+LoRaFadingTable::FadingType LoRaFadingTable::parseType(const char *name)
+{
+    if (!strcmp(name, "none") || !strcmp(name, ""))
+        return FADING_NONE;
+    else if (!strcmp(name, "rayleigh"))
+        return FADING_RAYLEIGH;
+    else if (!strcmp(name, "rician"))
+        return FADING_RICIAN;
+    else if (!strcmp(name, "nakagami"))
+        return FADING_NAKAGAMI;
+    else
+        throw cRuntimeError("Unknown fading type: '%s'", name);
+}
+
+void LoRaFadingTable::build(FadingType type, double parameter, int size)
+{
+    this->type = type;
+    quantiles.clear();
+    if (type == FADING_NONE)
+        return;
+    if (size < 2)
+        throw cRuntimeError("Fading table needs at least two entries");
+    switch (type) {
+        case FADING_RAYLEIGH:
+            // exponentially distributed power, the inverse is known in closed form
+            quantiles.resize(size);
+            for (int i = 0; i < size - 1; i++)
+                quantiles[i] = -std::log(1 - (double)i / (size - 1));
+            quantiles[size - 1] = -std::log(0.5 / (size - 1));
+            break;
+        case FADING_RICIAN: {
+            double k = parameter;
+            if (k < 0)
+                throw cRuntimeError("Rician K factor must not be negative");
+            buildFromDensity(size, 20, [k] (double x) {
+                double z = 2 * std::sqrt(k * (k + 1) * x);
+                return (k + 1) * std::exp(z - k - (k + 1) * x) * scaledBesselI0(z);
+            });
+            break;
+        }
+        case FADING_NAKAGAMI: {
+            double shape = parameter;
+            if (shape < 0.5)
+                throw cRuntimeError("Nakagami shape factor must be at least 0.5");
+            double logNorm = shape * std::log(shape) - std::lgamma(shape);
+            buildFromDensity(size, 20, [shape, logNorm] (double x) {
+                return std::exp(logNorm + (shape - 1) * std::log(x) - shape * x);
+            });
+            break;
+        }
+        default:
+            throw cRuntimeError("Unknown fading type");
+    }
+}
+
+void LoRaFadingTable::buildFromDensity(int size, double maxGain, std::function<double (double)> density)
+{
+    // integrate the density with the midpoint rule, which also copes with the
+    // integrable singularity at zero of Nakagami fading with m < 1
+    const int numSteps = 64 * size;
+    const double step = maxGain / numSteps;
+    std::vector<double> cdf(numSteps + 1, 0.0);
+    for (int j = 0; j < numSteps; j++)
+        cdf[j + 1] = cdf[j] + density((j + 0.5) * step) * step;
+    double total = cdf[numSteps];
+    quantiles.resize(size);
+    int j = 0;
+    for (int i = 0; i < size; i++) {
+        double u = std::min((double)i / (size - 1), 1 - 0.5 / (size - 1)) * total;
+        while (j < numSteps - 1 && cdf[j + 1] < u)
+            j++;
+        double width = cdf[j + 1] - cdf[j];
+        double alpha = width > 0 ? (u - cdf[j]) / width : 0;
+        quantiles[i] = (j + alpha) * step;
+    }
+}
+
+double LoRaFadingTable::getGain(double u) const
+{
+    if (type == FADING_NONE)
+        return 1;
+    double position = u * (quantiles.size() - 1);
+    size_t index = (size_t)position;
+    if (index >= quantiles.size() - 1)
+        return quantiles.back();
+    double alpha = position - index;
+    return quantiles[index] + alpha * (quantiles[index + 1] - quantiles[index]);
+}
+
+} // namespace flora
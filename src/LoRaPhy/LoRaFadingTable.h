@@ -0,0 +1,65 @@
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+// 
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see http://www.gnu.org/licenses/.
+// 
+
+#ifndef LORAPHY_LORAFADINGTABLE_H_
+#define LORAPHY_LORAFADINGTABLE_H_
+
+#include <functional>
+#include <vector>
+
+namespace flora {
+
+/**
+ * Inverse CDF of a unit mean block fading power gain, tabulated at equally
+ * spaced quantiles. Sampling a gain costs one uniform variate and one
+ * interpolated table read.
+ */
+class LoRaFadingTable
+{
+  public:
+    enum FadingType {
+        FADING_NONE,
+        FADING_RAYLEIGH,
+        FADING_RICIAN,
+        FADING_NAKAGAMI
+    };
+
+  protected:
+    FadingType type = FADING_NONE;
+    /** Power gain at quantile i / (size - 1) */
+    std::vector<double> quantiles;
+
+  protected:
+    void buildFromDensity(int size, double maxGain, std::function<double (double)> density);
+
+  public:
+    static FadingType parseType(const char *name);
+
+    /**
+     * Fills the table; parameter is the K factor (linear) for Rician and the
+     * shape m for Nakagami fading, unused otherwise.
+     */
+    void build(FadingType type, double parameter, int size);
+
+    FadingType getType() const { return type; }
+    bool isEnabled() const { return type != FADING_NONE; }
+
+    /** Maps a uniform variate in [0, 1) to a power gain */
+    double getGain(double u) const;
+};
+
+} // namespace flora
+
+#endif /* LORAPHY_LORAFADINGTABLE_H_ */
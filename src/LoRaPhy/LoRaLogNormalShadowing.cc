@@ -52,6 +52,13 @@ double LoRaLogNormalShadowing::computePathLoss(mps propagationSpeed, Hz frequenc
     return math::dB2fraction(-PL_db);
 }
 
+double LoRaLogNormalShadowing::computeMeanPathLoss(mps propagationSpeed, Hz frequency, m distance) const
+{
+    double PL_d0_db = 127.41;
+    double PL_db = PL_d0_db + 10 * gamma * log10(unit(distance / d0).get());
+    return math::dB2fraction(-PL_db);
+}
+
 m LoRaLogNormalShadowing::computeRange(W transmissionPower) const
 {
     // parameters taken from paper "Do LoRa Low-Power Wide-Area Networks Scale?"
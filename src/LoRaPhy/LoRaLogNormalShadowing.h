@@ -17,6 +17,7 @@
 #define LORAPHY_LORALOGNORMALSHADOWING_H_
 
 #include "inet/physicallayer/wireless/common/pathloss/FreeSpacePathLoss.h"
+#include "ILoRaMeanPathLoss.h"
 
 using namespace inet;
 using namespace inet::physicallayer;
@@ -25,7 +26,7 @@ namespace flora {
 /**
  * This class implements the log normal shadowing model.
  */
-class LoRaLogNormalShadowing : public FreeSpacePathLoss
+class LoRaLogNormalShadowing : public FreeSpacePathLoss, public ILoRaMeanPathLoss
 {
   protected:
     m d0;
@@ -40,6 +41,7 @@ class LoRaLogNormalShadowing : public FreeSpacePathLoss
     virtual std::ostream& printToStream(std::ostream& stream, int level, int evFlags = 0) const override;
     //virtual double computePathLoss(const ITransmission *transmission, const IArrival *arrival) const override;
     virtual double computePathLoss(mps propagationSpeed, Hz frequency, m distance) const override;
+    virtual double computeMeanPathLoss(mps propagationSpeed, Hz frequency, m distance) const override;
     m computeRange(W transmissionPower) const;
 };
 
@@ -16,6 +16,9 @@
 #include "../LoRa/LoRaMacFrame_m.h"
 #include "LoRaBandListening.h"
 #include "LoRaTransmission.h"
+#include "ILoRaArrivalHandler.h"
+#include "ILoRaMeanPathLoss.h"
+#include "LoRaReception.h"
 #include "inet/common/INETUtils.h"
 #include "inet/common/ModuleAccess.h"
 #include "inet/common/Simsignals.h"
@@ -28,7 +31,6 @@
 #include "inet/physicallayer/wireless/common/radio/packetlevel/Radio.h"
 #include "inet/physicallayer/wireless/common/medium/RadioMedium.h"
 #include "inet/physicallayer/wireless/common/contract/packetlevel/SignalTag_m.h"
-#include "inet/physicallayer/wireless/common/contract/packetlevel/IErrorModel.h"
 
 namespace flora {
 
@@ -40,6 +42,182 @@ LoRaMedium::LoRaMedium() : RadioMedium()
 
 LoRaMedium::~LoRaMedium()
 {
+    for (auto timer : pendingArrivalBuckets) {
+        delete static_cast<ArrivalBucket *>(timer->getContextPointer());
+        cancelAndDelete(timer);
+    }
+    cancelAndDelete(expiryRingTimer);
+}
+
+void LoRaMedium::initialize(int stage)
+{
+    RadioMedium::initialize(stage);
+    if (stage == INITSTAGE_LOCAL) {
+        directSignalDelivery = par("directSignalDelivery");
+        arrivalBucketLength = par("arrivalBucketLength");
+        if (directSignalDelivery && arrivalBucketLength <= 0)
+            throw cRuntimeError("arrivalBucketLength must be positive when directSignalDelivery is enabled");
+        transmissionExpiryRing = par("transmissionExpiryRing");
+        expiryBucketsPerTransmission = par("expiryBucketsPerTransmission");
+        if (transmissionExpiryRing && expiryBucketsPerTransmission <= 0)
+            throw cRuntimeError("expiryBucketsPerTransmission must be positive when transmissionExpiryRing is enabled");
+        expiryRingTimer = new cMessage("expiryRing");
+    }
+}
+
+void LoRaMedium::handleMessage(cMessage *message)
+{
+    if (isArrivalBucketTimer(message))
+        deliverArrivalBucket(message);
+    else if (message == expiryRingTimer)
+        removeExpiredTransmissions();
+    else
+        RadioMedium::handleMessage(message);
+}
+
+bool LoRaMedium::isArrivalBucketTimer(const cMessage *message) const
+{
+    return !strcmp(message->getName(), "arrivalBucket");
+}
+
+void LoRaMedium::sendToRadio(IRadio *transmitter, const IRadio *receiver, const IWirelessSignal *signal)
+{
+    // radios that do not implement the callback keep the per receiver message path
+    if (!directSignalDelivery || dynamic_cast<const ILoRaArrivalHandler *>(receiver) == nullptr) {
+        RadioMedium::sendToRadio(transmitter, receiver, signal);
+        return;
+    }
+    const ITransmission *transmission = signal->getTransmission();
+    if (receiver != transmitter && isPotentialReceiver(receiver, transmission))
+        addToArrivalBucket(receiver, transmission, getArrival(receiver, transmission));
+}
+
+void LoRaMedium::addToArrivalBucket(const IRadio *receiver, const ITransmission *transmission, const IArrival *arrival)
+{
+    Enter_Method_Silent();
+    // buckets are only ever extended while the same transmission is being sent
+    if (openArrivalBucketsTransmission != transmission) {
+        openArrivalBuckets.clear();
+        openArrivalBucketsTransmission = transmission;
+    }
+    const simtime_t arrivalStartTime = arrival->getStartTime();
+    int64_t bucketIndex = (int64_t)(arrivalStartTime / arrivalBucketLength);
+    cMessage *timer;
+    auto it = openArrivalBuckets.find(bucketIndex);
+    if (it == openArrivalBuckets.end()) {
+        timer = new cMessage("arrivalBucket");
+        auto bucket = new ArrivalBucket();
+        bucket->transmission = transmission;
+        timer->setContextPointer(bucket);
+        openArrivalBuckets[bucketIndex] = timer;
+        pendingArrivalBuckets.insert(timer);
+        scheduleAt(arrivalStartTime, timer);
+    }
+    else {
+        timer = it->second;
+        // the bucket fires at the earliest arrival it contains
+        if (arrivalStartTime < timer->getArrivalTime()) {
+            cancelEvent(timer);
+            scheduleAt(arrivalStartTime, timer);
+        }
+    }
+    static_cast<ArrivalBucket *>(timer->getContextPointer())->receivers.push_back(receiver);
+}
+
+void LoRaMedium::deliverArrivalBucket(cMessage *timer)
+{
+    auto bucket = static_cast<ArrivalBucket *>(timer->getContextPointer());
+    pendingArrivalBuckets.erase(timer);
+    if (openArrivalBucketsTransmission == bucket->transmission) {
+        for (auto it = openArrivalBuckets.begin(); it != openArrivalBuckets.end(); ++it) {
+            if (it->second == timer) {
+                openArrivalBuckets.erase(it);
+                break;
+            }
+        }
+    }
+    for (auto receiver : bucket->receivers)
+        check_and_cast<ILoRaArrivalHandler *>(const_cast<IRadio *>(receiver))->handleArrival(bucket->transmission);
+    delete bucket;
+    delete timer;
+}
+
+WirelessSignal *LoRaMedium::createArrivalSignal(const IRadio *receiver, const ITransmission *transmission)
+{
+    auto signal = check_and_cast<WirelessSignal *>(createReceiverSignal(transmission));
+    // the signal is never sent, so fill in what sendDirect() would have set
+    signal->setArrival(check_and_cast<const cModule *>(receiver)->getId(), receiver->getRadioGate()->getId(), getArrival(receiver, transmission)->getStartTime());
+    communicationCache->setCachedSignal(receiver, transmission, signal);
+    signalSendCount++;
+    return signal;
+}
+
+void LoRaMedium::initializeExpiryRing()
+{
+    // the limits are only known once the radios have registered
+    simtime_t maxTransmissionDuration = mediumLimitCache->getMaxTransmissionDuration();
+    if (maxTransmissionDuration <= 0)
+        throw cRuntimeError("maxTransmissionDuration must be positive to size the transmission expiry ring");
+    expiryBucketLength = maxTransmissionDuration / expiryBucketsPerTransmission;
+    // interference ends at most two transmission durations (plus propagation) after now
+    resizeExpiryRing(2 * expiryBucketsPerTransmission + 2);
+}
+
+void LoRaMedium::resizeExpiryRing(size_t size)
+{
+    std::vector<std::vector<const ITransmission *>> ring(size);
+    for (auto& slot : expiryRing) {
+        for (auto transmission : slot) {
+            int64_t bucketIndex = (int64_t)(communicationCache->getCachedInterferenceEndTime(transmission) / expiryBucketLength);
+            ring[bucketIndex % size].push_back(transmission);
+        }
+    }
+    expiryRing.swap(ring);
+}
+
+void LoRaMedium::addToExpiryRing(const ITransmission *transmission)
+{
+    if (expiryRing.empty())
+        initializeExpiryRing();
+    int64_t bucketIndex = (int64_t)(communicationCache->getCachedInterferenceEndTime(transmission) / expiryBucketLength);
+    if (expiryRingCount == 0)
+        expiryRingHead = expiryRingTail = bucketIndex;
+    int64_t head = std::min(expiryRingHead, bucketIndex);
+    int64_t tail = std::max(expiryRingTail, bucketIndex);
+    if (tail - head >= (int64_t)expiryRing.size()) {
+        size_t size = expiryRing.size();
+        while (tail - head >= (int64_t)size)
+            size *= 2;
+        resizeExpiryRing(size);
+    }
+    expiryRing[bucketIndex % expiryRing.size()].push_back(transmission);
+    expiryRingCount++;
+    expiryRingTail = tail;
+    if (bucketIndex < expiryRingHead || !expiryRingTimer->isScheduled()) {
+        expiryRingHead = bucketIndex;
+        // the bucket is purged once all of its interference end times have passed
+        rescheduleAt((bucketIndex + 1) * expiryBucketLength, expiryRingTimer);
+    }
+}
+
+void LoRaMedium::removeExpiredTransmissions()
+{
+    auto& slot = expiryRing[expiryRingHead % expiryRing.size()];
+    for (auto transmission : slot) {
+        emit(signalRemovedSignal, check_and_cast<const cObject *>(transmission));
+        const IWirelessSignal *signal = communicationCache->getCachedSignal(transmission);
+        communicationCache->removeTransmission(transmission);
+        delete signal;
+        delete transmission;
+    }
+    expiryRingCount -= slot.size();
+    slot.clear();
+    if (expiryRingCount > 0) {
+        do
+            expiryRingHead++;
+        while (expiryRing[expiryRingHead % expiryRing.size()].empty());
+        scheduleAt((expiryRingHead + 1) * expiryBucketLength, expiryRingTimer);
+    }
 }
 
 bool LoRaMedium::matchesMacAddressFilter(const IRadio *radio, const Packet *packet) const
@@ -79,14 +257,7 @@ const IReceptionResult *LoRaMedium::getReceptionResult(const IRadio *radio, cons
             snirInd->setMinimumSnir(snir->getMin());
             snirInd->setMaximumSnir(snir->getMax());
         }
-        if (!pkt->findTag<ErrorRateInd>()) {
-            auto errorModel = dynamic_cast<IErrorModel *>(getSubmodule("errorModel"));
-            const ISnir *snir = getSNIR(radio, transmission);
-            auto errorRateInd = pkt->addTagIfAbsent<ErrorRateInd>(); // TODO: should be done  setPacketErrorRate(packetModel->getPER());
-            errorRateInd->setPacketErrorRate(errorModel ? errorModel->computePacketErrorRate(snir, IRadioSignal::SIGNAL_PART_WHOLE) : 0.0);
-            errorRateInd->setBitErrorRate(errorModel ? errorModel->computeBitErrorRate(snir, IRadioSignal::SIGNAL_PART_WHOLE) : 0.0);
-            errorRateInd->setSymbolErrorRate(errorModel ? errorModel->computeSymbolErrorRate(snir, IRadioSignal::SIGNAL_PART_WHOLE) : 0.0);
-        }
+        // error rates are evaluated by the receiving radio, only for frames sent up to the MAC
 
         communicationCache->setCachedReceptionResult(radio, transmission, result);
         EV_DEBUG << "Receiving " << transmission << " from medium by " << radio << " arrives as " << result->getReception() << " and results in " << result << endl;
@@ -115,9 +286,53 @@ void LoRaMedium::addTransmission(const IRadio *transmitterRadio, const ITransmis
         }
     });
     communicationCache->setCachedInterferenceEndTime(transmission, maxArrivalEndTime + mediumLimitCache->getMaxTransmissionDuration());
-    if (!removeNonInterferingTransmissionsTimer->isScheduled())
+    const LoRaTransmission *loRaTransmission = check_and_cast<const LoRaTransmission *>(transmission);
+    auto& byEndTime = liveTransmissions[std::make_pair(loRaTransmission->getLoRaCF().get(), loRaTransmission->getLoRaSF())];
+    byEndTime.erase(byEndTime.begin(), byEndTime.lower_bound(simTime()));
+    byEndTime.emplace(transmission->getEndTime(), loRaTransmission);
+    if (transmissionExpiryRing)
+        addToExpiryRing(transmission);
+    else if (!removeNonInterferingTransmissionsTimer->isScheduled())
         scheduleAt(communicationCache->getCachedInterferenceEndTime(transmission), removeNonInterferingTransmissionsTimer);
     emit(signalAddedSignal, check_and_cast<const cObject *>(transmission));
 }
 
+bool LoRaMedium::isChannelActive(const IRadio *radio, Hz centerFrequency, int spreadFactor, W threshold) const
+{
+    Enter_Method_Silent("isChannelActive");
+    auto it = liveTransmissions.find(std::make_pair(centerFrequency.get(), spreadFactor));
+    if (it == liveTransmissions.end())
+        return false;
+    auto& byEndTime = it->second;
+    // transmissions are deleted only after their interference end time, so
+    // everything from the current time on still points to a live object
+    byEndTime.erase(byEndTime.begin(), byEndTime.lower_bound(simTime()));
+    if (byEndTime.empty()) {
+        liveTransmissions.erase(it);
+        return false;
+    }
+    const Coord position = radio->getAntenna()->getMobility()->getCurrentPosition();
+    auto meanPathLoss = dynamic_cast<const ILoRaMeanPathLoss *>(pathLoss);
+    for (const auto& entry : byEndTime) {
+        const LoRaTransmission *transmission = entry.second;
+        if (transmission->getTransmitterId() == radio->getId())
+            continue;
+        // the power the actual reception at this radio got, if it was computed;
+        // otherwise the mean path loss, since drawing shadowing here would
+        // shift the RNG stream of every later reception
+        W power;
+        if (auto reception = communicationCache->getCachedReception(radio, transmission))
+            power = check_and_cast<const LoRaReception *>(reception)->getPower();
+        else {
+            m distance = m(position.distance(transmission->getStartPosition()));
+            double loss = meanPathLoss != nullptr ? meanPathLoss->computeMeanPathLoss(propagation->getPropagationSpeed(), centerFrequency, distance)
+                    : pathLoss->computePathLoss(propagation->getPropagationSpeed(), centerFrequency, distance);
+            power = transmission->getLoRaTP() * loss;
+        }
+        if (power >= threshold)
+            return true;
+    }
+    return false;
+}
+
 }
@@ -28,23 +28,108 @@
 #include "inet/physicallayer/wireless/common/contract/packetlevel/IMediumLimitCache.h"
 #include "inet/physicallayer/wireless/common/contract/packetlevel/INeighborCache.h"
 #include "inet/physicallayer/wireless/common/contract/packetlevel/IRadioMedium.h"
+#include "inet/physicallayer/wireless/common/signal/WirelessSignal.h"
 #include <algorithm>
+#include <map>
+#include <set>
+#include <vector>
 
 namespace flora {
+
+class LoRaTransmission;
 class LoRaMedium : public RadioMedium
 {
     friend class LoRaGWRadio;
     friend class LoRaRadio;
 
 protected:
+    /**
+     * All receivers of one transmission whose arrival start times fall into
+     * the same bucket share a single self message.
+     */
+    struct ArrivalBucket
+    {
+        const ITransmission *transmission = nullptr;
+        std::vector<const IRadio *> receivers;
+    };
+
+    /** @name Direct signal delivery */
+    //@{
+    bool directSignalDelivery = false;
+    simtime_t arrivalBucketLength;
+    /** Buckets of the transmission currently being sent, keyed by bucket index */
+    std::map<int64_t, cMessage *> openArrivalBuckets;
+    const ITransmission *openArrivalBucketsTransmission = nullptr;
+    /** All scheduled bucket timers, owned by the medium */
+    std::set<cMessage *> pendingArrivalBuckets;
+    //@}
+
+    /** @name Transmission expiry ring */
+    //@{
+    bool transmissionExpiryRing = true;
+    int expiryBucketsPerTransmission = 0;
+    /** Width of one ring slot, derived from maxTransmissionDuration on first use */
+    simtime_t expiryBucketLength;
+    /** Slot (index % size) holds the transmissions whose interference ends in bucket index */
+    std::vector<std::vector<const ITransmission *>> expiryRing;
+    /** Earliest and latest non-empty bucket index, valid while expiryRingCount > 0 */
+    int64_t expiryRingHead = 0;
+    int64_t expiryRingTail = 0;
+    size_t expiryRingCount = 0;
+    cMessage *expiryRingTimer = nullptr;
+    //@}
+
+    /** @name Channel activity index */
+    //@{
+    /**
+     * Transmissions on the air keyed by (center frequency in Hz, spreading
+     * factor) and ordered by end time. Entries that ended are pruned when a
+     * new transmission starts on the same channel and by isChannelActive(),
+     * so each channel holds at most the transmissions currently on the air
+     * plus the ones ended since, and deleted transmissions are never
+     * dereferenced. A query thus costs the channel lookup plus a scan of the
+     * transmissions overlapping it, which all have to be looked at anyway
+     * since any of them may be received above the threshold.
+     */
+    mutable std::map<std::pair<double, int>, std::multimap<simtime_t, const LoRaTransmission *>> liveTransmissions;
+    //@}
+
+protected:
+    virtual void initialize(int stage) override;
+    virtual void handleMessage(cMessage *message) override;
     virtual bool matchesMacAddressFilter(const IRadio *radio, const Packet *packet) const override;
+
+    virtual bool isArrivalBucketTimer(const cMessage *message) const;
+    virtual void addToArrivalBucket(const IRadio *receiver, const ITransmission *transmission, const IArrival *arrival);
+    virtual void deliverArrivalBucket(cMessage *timer);
+
+    virtual void initializeExpiryRing();
+    virtual void resizeExpiryRing(size_t size);
+    virtual void addToExpiryRing(const ITransmission *transmission);
+    virtual void removeExpiredTransmissions();
         //@}
     public:
       LoRaMedium();
       virtual ~LoRaMedium();
+      virtual void sendToRadio(IRadio *transmitter, const IRadio *receiver, const IWirelessSignal *signal) override;
+      /**
+       * Creates the per receiver signal for a radio that decided to actually
+       * receive an arrival delivered through handleArrival().
+       */
+      virtual WirelessSignal *createArrivalSignal(const IRadio *receiver, const ITransmission *transmission);
       //virtual const IReceptionDecision *getReceptionDecision(const IRadio *receiver, const IListening *listening, const ITransmission *transmission, IRadioSignal::SignalPart part) const override;
       virtual const IReceptionResult *getReceptionResult(const IRadio *receiver, const IListening *listening, const ITransmission *transmission) const override;
       virtual void addTransmission(const IRadio *transmitter, const ITransmission *transmission);
+      /**
+       * Channel activity detection: returns true if another transmission with
+       * the given center frequency and spreading factor is currently on the
+       * air and arrives at the radio's position with at least the threshold
+       * power. The channel lookup is logarithmic in the number of channels,
+       * only the transmissions live on that channel are inspected. Sensing
+       * never draws shadowing: it uses the cached reception at the radio or
+       * the mean path loss (ILoRaMeanPathLoss).
+       */
+      virtual bool isChannelActive(const IRadio *radio, Hz centerFrequency, int spreadFactor, W threshold) const;
 };
 }
 #endif /* LORAPHY_LORAMEDIUM_H_ */
@@ -32,49 +32,29 @@ LoRaModulation::LoRaModulation(int spreadFactor,Hz bandwith,bps bitRate, int not
 
 double LoRaModulation::calculateBER(double snir, Hz bandwidth, bps bitrate) const
 {
-    // Taken from MiXiM 802.15.4 decider by Karl Wessel
-    // Valid for IEEE 802.15.4 2.45 GHz OQPSK modulation
-    // Following formula is defined in IEEE 802.15.4 standard, please check the
-    // 2006 standard, page 268, section E.4.1.8 Bit error rate (BER)
-    // calculations, formula 7). Here you can see that the factor of 20.0 is correct ;).
-    const double dSNRFct = 20.0 *snir *bandwidth.get() / bitrate.get(); // TODO is this correct?
-    double dSumK = 0;
-    int k = 2;
-
-    /* following loop was optimized by using n_choose_k symmetries
-       for (k=2; k <= 16; ++k) {
-        dSumK += pow(-1.0, k) * n_choose_k(16, k) * exp(dSNRFct * (1.0 / k - 1.0));
-       }
-     */
-
-    // n_choose_k(16, k) == n_choose_k(16, 16-k)
-    for ( ; k < 8; k += 2) {
-        // k will be 2, 4, 6 (symmetric values: 14, 12, 10)
-        dSumK += math::n_choose_k(16, k) * (exp(dSNRFct * (1.0 / k - 1.0)) + exp(dSNRFct * (1.0 / (16 - k) - 1.0)));
-    }
-
-    // for k =  8 (which does not have a symmetric value)
-    k = 8;
-    dSumK += math::n_choose_k(16, k) * exp(dSNRFct * (1.0 / k - 1.0));
-    for (k = 3; k < 8; k += 2) {
-        // k will be 3, 5, 7 (symmetric values: 13, 11, 9)
-        dSumK -= math::n_choose_k(16, k) * (exp(dSNRFct * (1.0 / k - 1.0)) + exp(dSNRFct * (1.0 / (16 - k) - 1.0)));
-    }
+    return computeChirpBitErrorRate(snir, spreadFactor);
+}
 
-    // for k = 15 (because of missing k=1 value)
-    k = 15;
-    dSumK -= math::n_choose_k(16, k) * exp(dSNRFct * (1.0 / k - 1.0));
+double LoRaModulation::calculateSER(double snir, Hz bandwidth, bps bitrate) const
+{
+    return computeChirpSymbolErrorRate(snir, spreadFactor);
+}
 
-    // for k = 16 (because of missing k=0 value)
-    k = 16;
-    dSumK += math::n_choose_k(16, k) * exp(dSNRFct * (1.0 / k - 1.0));
-    return (8.0 / 15) * (1.0 / 16) * dSumK;
+double LoRaModulation::computeChirpSymbolErrorRate(double snir, int spreadFactor)
+{
+    // Closed form approximation by Elshabrawy and Robert, "Closed-Form
+    // Approximation of LoRa Modulation BER Performance", IEEE Comm. Letters 2018.
+    // The SNIR is measured in the channel bandwidth, so the 2^SF processing
+    // gain of the dechirp + FFT demodulator appears explicitly.
+    double x = std::sqrt(2.0 * std::pow(2.0, spreadFactor) * snir) - std::sqrt(1.386 * spreadFactor + 1.154);
+    return 0.5 * std::erfc(x / std::sqrt(2.0));
 }
 
-double LoRaModulation::calculateSER(double snir, Hz bandwidth, bps bitrate) const
+double LoRaModulation::computeChirpBitErrorRate(double snir, int spreadFactor)
 {
-    return NaN;
-//    throw cRuntimeError("Not yet implemented");
+    // orthogonal signalling: a wrong symbol flips each of its SF bits with probability 2^(SF-1) / (2^SF - 1)
+    double numSymbols = std::pow(2.0, spreadFactor);
+    return computeChirpSymbolErrorRate(snir, spreadFactor) * (numSymbols / 2) / (numSymbols - 1);
 }
 
 } // namespace inet
@@ -42,6 +42,10 @@ class LoRaModulation : public ApskModulationBase
 
     double calculateBER(double snir, Hz bandwidth, bps bitrate) const;
     double calculateSER(double snir, Hz bandwidth, bps bitrate) const;
+
+    /** Non-coherent CSS symbol error rate in AWGN for a linear SNIR */
+    static double computeChirpSymbolErrorRate(double snir, int spreadFactor);
+    static double computeChirpBitErrorRate(double snir, int spreadFactor);
 };
 
 } // namespace inet
@@ -27,7 +27,9 @@ LoRaNeighborCache::LoRaNeighborCache() :
     updateNeighborListsTimer(nullptr),
     refillPeriod(NaN),
     range(NaN),
-    maxSpeed(NaN)
+    maxSpeed(NaN),
+    incrementalUpdate(false),
+    cellSize(NaN)
 {
 }
 
@@ -37,10 +39,21 @@ void LoRaNeighborCache::initialize(int stage)
         radioMedium = getModuleFromPar<LoRaMedium>(par("radioMediumModule"), this);
         refillPeriod = par("refillPeriod");
         range = par("range");
+        incrementalUpdate = par("incrementalUpdate");
         updateNeighborListsTimer = new cMessage("updateNeighborListsTimer");
+        if (incrementalUpdate)
+            getSimulation()->getSystemModule()->subscribe(IMobility::mobilityStateChangedSignal, this);
     }
     else if (stage == INITSTAGE_PHYSICAL_LAYER_NEIGHBOR_CACHE) {
         maxSpeed = radioMedium->getMediumLimitCache()->getMaxSpeed().get();
+        if (incrementalUpdate) {
+            // a cell is at least one neighbor radius wide, so neighbors are always in the 3x3 block around a radio
+            cellSize = getRadius();
+            grid.clear();
+            for (auto & elem : radios)
+                insertIntoGrid(elem);
+            movedRadios.clear();
+        }
         updateNeighborLists();
         if (maxSpeed != 0)
             scheduleAt(simTime() + refillPeriod, updateNeighborListsTimer);
@@ -53,13 +66,14 @@ std::ostream& LoRaNeighborCache::printToStream(std::ostream& stream, int level,
     if (level <= PRINT_LEVEL_TRACE)
         stream << ", refillPeriod = " << refillPeriod
                << ", range = " << range
-               << ", maxSpeed = " << maxSpeed;
+               << ", maxSpeed = " << maxSpeed
+               << ", incrementalUpdate = " << incrementalUpdate;
     return stream;
 }
 
 void LoRaNeighborCache::sendToNeighbors(IRadio *transmitter, const IWirelessSignal *frame, double range) const
 {
-    EV << "LoRaMedium->LoRaNeighborCache sendToNeighbors" << endl;
+    EV_TRACE << "LoRaMedium->LoRaNeighborCache sendToNeighbors" << endl;
     if (this->range < range)
         throw cRuntimeError("The transmitter's (id: %d) range is bigger then the cache range", transmitter->getId());
 
@@ -79,7 +93,10 @@ void LoRaNeighborCache::handleMessage(cMessage *msg)
     if (!msg->isSelfMessage())
         throw cRuntimeError("This module only handles self messages");
 
-    updateNeighborLists();
+    if (incrementalUpdate)
+        updateMovedRadios();
+    else
+        updateNeighborLists();
 
     scheduleAt(simTime() + refillPeriod, msg);
 }
@@ -102,13 +119,126 @@ void LoRaNeighborCache::updateNeighborList(RadioEntry *radioEntry)
 
 }
 
+int64_t LoRaNeighborCache::computeCell(const Coord& position) const
+{
+    int64_t x = (int64_t)std::floor(position.x / cellSize);
+    int64_t y = (int64_t)std::floor(position.y / cellSize);
+    return makeCell(x, y);
+}
+
+void LoRaNeighborCache::insertIntoGrid(RadioEntry *radioEntry)
+{
+    radioEntry->cell = computeCell(radioEntry->radio->getAntenna()->getMobility()->getCurrentPosition());
+    grid[radioEntry->cell].push_back(radioEntry);
+}
+
+void LoRaNeighborCache::removeFromGrid(RadioEntry *radioEntry)
+{
+    auto it = grid.find(radioEntry->cell);
+    if (it == grid.end())
+        return;
+    auto& cellEntries = it->second;
+    cellEntries.erase(std::remove(cellEntries.begin(), cellEntries.end(), radioEntry), cellEntries.end());
+    if (cellEntries.empty())
+        grid.erase(it);
+}
+
+void LoRaNeighborCache::updateNeighborListFromGrid(RadioEntry *radioEntry)
+{
+    Coord radioPosition = radioEntry->radio->getAntenna()->getMobility()->getCurrentPosition();
+    double radius = getRadius();
+    int64_t x = radioEntry->cell >> 32;
+    int64_t y = (int32_t)(radioEntry->cell & 0xFFFFFFFF);
+    radioEntry->neighborVector.clear();
+    for (int64_t i = x - 1; i <= x + 1; i++) {
+        for (int64_t j = y - 1; j <= y + 1; j++) {
+            auto it = grid.find(makeCell(i, j));
+            if (it == grid.end())
+                continue;
+            for (auto & elem : it->second) {
+                const IRadio *otherRadio = elem->radio;
+                if (elem != radioEntry && otherRadio->getAntenna()->getMobility()->getCurrentPosition().sqrdist(radioPosition) <= radius * radius)
+                    radioEntry->neighborVector.push_back(otherRadio);
+            }
+        }
+    }
+}
+
+void LoRaNeighborCache::addToNeighborLists(RadioEntry *radioEntry)
+{
+    // neighborhood is symmetric: everyone in our list gets us in theirs
+    for (auto & elem : radioEntry->neighborVector) {
+        RadioEntry *otherEntry = radioToEntry[elem];
+        if (!otherEntry->moved)
+            otherEntry->neighborVector.push_back(radioEntry->radio);
+    }
+}
+
+void LoRaNeighborCache::updateMovedRadios()
+{
+    EV_DETAIL << "Updating the neighbor lists of " << movedRadios.size() << " moved radios" << endl;
+    // only the moved radios leave the lists of their old neighbors ...
+    for (auto & elem : movedRadios) {
+        for (auto & neighbor : elem->neighborVector) {
+            RadioEntry *otherEntry = radioToEntry[neighbor];
+            if (!otherEntry->moved) {
+                auto& otherNeighbors = otherEntry->neighborVector;
+                otherNeighbors.erase(std::remove(otherNeighbors.begin(), otherNeighbors.end(), elem->radio), otherNeighbors.end());
+            }
+        }
+        // ... and only those crossing a cell boundary are re-binned
+        int64_t cell = computeCell(elem->radio->getAntenna()->getMobility()->getCurrentPosition());
+        if (cell != elem->cell) {
+            removeFromGrid(elem);
+            elem->cell = cell;
+            grid[cell].push_back(elem);
+        }
+    }
+    for (auto & elem : movedRadios)
+        updateNeighborListFromGrid(elem);
+    for (auto & elem : movedRadios)
+        addToNeighborLists(elem);
+    for (auto & elem : movedRadios)
+        elem->moved = false;
+    movedRadios.clear();
+}
+
+void LoRaNeighborCache::receiveSignal(cComponent *source, simsignal_t signal, cObject *obj, cObject *details)
+{
+    if (signal == IMobility::mobilityStateChangedSignal) {
+        auto it = mobilityToEntry.find(dynamic_cast<IMobility *>(obj));
+        if (it != mobilityToEntry.end() && !it->second->moved) {
+            it->second->moved = true;
+            movedRadios.push_back(it->second);
+        }
+    }
+}
+
 void LoRaNeighborCache::addRadio(const IRadio *radio)
 {
     RadioEntry *newEntry = new RadioEntry(radio);
     radios.push_back(newEntry);
     radioToEntry[radio] = newEntry;
-    updateNeighborLists();
+    if (incrementalUpdate) {
+        mobilityToEntry[radio->getAntenna()->getMobility()] = newEntry;
+        // before the neighbor cache init stage the grid is built in one go
+        if (!std::isnan(cellSize)) {
+            insertIntoGrid(newEntry);
+            updateNeighborListFromGrid(newEntry);
+            addToNeighborLists(newEntry);
+        }
+    }
+    else
+        updateNeighborLists();
     maxSpeed = radioMedium->getMediumLimitCache()->getMaxSpeed().get();
+    if (incrementalUpdate && cellSize < getRadius()) {
+        // a faster radio widened the neighbor radius, the cells must follow
+        cellSize = getRadius();
+        grid.clear();
+        for (auto & elem : radios)
+            insertIntoGrid(elem);
+        updateNeighborLists();
+    }
     if (maxSpeed != 0 && !updateNeighborListsTimer->isScheduled() && initialized())
         scheduleAt(simTime() + refillPeriod, updateNeighborListsTimer);
 }
@@ -118,6 +248,14 @@ void LoRaNeighborCache::removeRadio(const IRadio *radio)
     auto it = find(radios.begin(), radios.end(), radioToEntry[radio]);
     if (it != radios.end()) {
         removeRadioFromNeighborLists(radio);
+        if (incrementalUpdate) {
+            RadioEntry *radioEntry = *it;
+            if (!std::isnan(cellSize))
+                removeFromGrid(radioEntry);
+            mobilityToEntry.erase(radio->getAntenna()->getMobility());
+            if (radioEntry->moved)
+                movedRadios.erase(std::remove(movedRadios.begin(), movedRadios.end(), radioEntry), movedRadios.end());
+        }
         radios.erase(it);
         maxSpeed = radioMedium->getMediumLimitCache()->getMaxSpeed().get();
         if (maxSpeed == 0 && initialized())
@@ -131,14 +269,18 @@ void LoRaNeighborCache::removeRadio(const IRadio *radio)
 void LoRaNeighborCache::updateNeighborLists()
 {
     EV_DETAIL << "Updating the neighbor lists" << endl;
-    for (auto & elem : radios)
-        updateNeighborList(elem);
+    for (auto & elem : radios) {
+        if (incrementalUpdate)
+            updateNeighborListFromGrid(elem);
+        else
+            updateNeighborList(elem);
+    }
 }
 
 void LoRaNeighborCache::removeRadioFromNeighborLists(const IRadio *radio)
 {
     for (auto & elem : radios) {
-        Radios neighborVector = elem->neighborVector;
+        Radios& neighborVector = elem->neighborVector;
         auto it = find(neighborVector.begin(), neighborVector.end(), radio);
         if (it != neighborVector.end())
             neighborVector.erase(it);
@@ -19,12 +19,14 @@
 
 #include "inet/physicallayer/wireless/common/medium/RadioMedium.h"
 #include "LoRaPhy/LoRaMedium.h"
+#include "inet/mobility/contract/IMobility.h"
 #include <set>
+#include <unordered_map>
 #include <vector>
 
 namespace flora {
 
-class LoRaNeighborCache : public cSimpleModule, public INeighborCache
+class LoRaNeighborCache : public cSimpleModule, public cListener, public INeighborCache
 {
   public:
     struct RadioEntry
@@ -32,6 +34,9 @@ class LoRaNeighborCache : public cSimpleModule, public INeighborCache
         RadioEntry(const IRadio *radio) : radio(radio) {};
         const IRadio *radio;
         std::vector<const IRadio *> neighborVector;
+        /** Grid cell the radio is currently binned in (incremental mode) */
+        int64_t cell = 0;
+        bool moved = false;
         bool operator==(RadioEntry *rhs) const
         {
             return this->radio->getId() == rhs->radio->getId();
@@ -40,6 +45,7 @@ class LoRaNeighborCache : public cSimpleModule, public INeighborCache
     typedef std::vector<RadioEntry *> RadioEntries;
     typedef std::vector<const IRadio *> Radios;
     typedef std::map<const IRadio *, RadioEntry *> RadioEntryCache;
+    typedef std::unordered_map<int64_t, std::vector<RadioEntry *>> Grid;
 
   protected:
     LoRaMedium *radioMedium;
@@ -50,6 +56,16 @@ class LoRaNeighborCache : public cSimpleModule, public INeighborCache
     double range;
     double maxSpeed;
 
+    /** @name Incremental update of mobile radios */
+    //@{
+    bool incrementalUpdate;
+    double cellSize;
+    Grid grid;
+    std::map<const IMobility *, RadioEntry *> mobilityToEntry;
+    /** Radios whose mobility reported a change since the last refill */
+    std::vector<RadioEntry *> movedRadios;
+    //@}
+
   protected:
     virtual int numInitStages() const override { return NUM_INIT_STAGES; }
     virtual void initialize(int stage) override;
@@ -58,6 +74,18 @@ class LoRaNeighborCache : public cSimpleModule, public INeighborCache
     void updateNeighborLists();
     void removeRadioFromNeighborLists(const IRadio *radio);
 
+    double getRadius() const { return maxSpeed * refillPeriod + range; }
+    int64_t computeCell(const Coord& position) const;
+    /** Packs the grid coordinates into a cell key; shifts unsigned, as x may be negative */
+    static int64_t makeCell(int64_t x, int64_t y) { return (int64_t)(((uint64_t)x << 32) | (uint32_t)y); }
+    void insertIntoGrid(RadioEntry *radioEntry);
+    void removeFromGrid(RadioEntry *radioEntry);
+    void updateNeighborListFromGrid(RadioEntry *radioEntry);
+    void addToNeighborLists(RadioEntry *radioEntry);
+    void updateMovedRadios();
+
+    virtual void receiveSignal(cComponent *source, simsignal_t signal, cObject *obj, cObject *details) override;
+
   public:
     LoRaNeighborCache();
     ~LoRaNeighborCache();
@@ -44,4 +44,10 @@ double LoRaPathLossOulu::computePathLoss(mps propagationSpeed, Hz frequency, m d
     return math::dB2fraction(-PL_db);
 }
 
+double LoRaPathLossOulu::computeMeanPathLoss(mps propagationSpeed, Hz frequency, m distance) const
+{
+    double PL_db = B + 10 * n * log10(unit(distance/d0).get()) - antennaGain;
+    return math::dB2fraction(-PL_db);
+}
+
 }
@@ -17,6 +17,7 @@
 #define LORAPHY_LORAPATHLOSSOULU_H_
 
 #include "inet/physicallayer/wireless/common/pathloss/FreeSpacePathLoss.h"
+#include "ILoRaMeanPathLoss.h"
 
 using namespace inet;
 using namespace inet::physicallayer;
@@ -25,7 +26,7 @@ namespace flora {
 /**
  * This class implements the log normal shadowing model.
  */
-class LoRaPathLossOulu : public FreeSpacePathLoss
+class LoRaPathLossOulu : public FreeSpacePathLoss, public ILoRaMeanPathLoss
 {
   protected:
     m d0;
@@ -40,6 +41,7 @@ class LoRaPathLossOulu : public FreeSpacePathLoss
   public:
     LoRaPathLossOulu();
     virtual double computePathLoss(mps propagationSpeed, Hz frequency, m distance) const override;
+    virtual double computeMeanPathLoss(mps propagationSpeed, Hz frequency, m distance) const override;
 };
 
 } // namespace inet
@@ -13,6 +13,8 @@
 // along with this program.  If not, see http://www.gnu.org/licenses/.
 // 
 
+#include <algorithm>
+
 #include "LoRaReceiver.h"
 #include "LoRaReception.h"
 #include "inet/physicallayer/wireless/common/analogmodel/packetlevel/ScalarNoise.h"
@@ -24,6 +26,20 @@ namespace flora {
 
 Define_Module(LoRaReceiver);
 
+std::map<std::pair<const cXMLElement *, std::string>, LoRaReceiver::CaptureThresholds> LoRaReceiver::captureThresholdCache;
+
+// SX127x co-channel rejection in dB at 125 kHz (Croce et al., "Impact of LoRa
+// Imperfect Orthogonality"), used for the sx127x family if the XML defines no
+// matrix for it
+static const int defaultNonOrthDelta[6][6] = {
+   {1, -8, -9, -9, -9, -9},
+   {-11, 1, -11, -12, -13, -13},
+   {-15, -13, 1, -13, -14, -15},
+   {-19, -18, -17, 1, -17, -18},
+   {-22, -22, -21, -20, 1, -20},
+   {-25, -25, -25, -24, -23, 1}
+};
+
 LoRaReceiver::LoRaReceiver() :
     snirThreshold(NaN)
 {
@@ -44,9 +60,75 @@ void LoRaReceiver::initialize(int stage)
         LoRaReceptionCollision = registerSignal("LoRaReceptionCollision");
         numCollisions = 0;
         rcvBelowSensitivity = 0;
+        cXMLElement *xmlConfig = par("rejectionMatrices").xmlValue();
+        const char *radioFamily = par("radioFamily");
+        auto key = std::make_pair((const cXMLElement *)xmlConfig, std::string(radioFamily));
+        auto it = captureThresholdCache.find(key);
+        if (it == captureThresholdCache.end()) {
+            CaptureThresholds thresholds;
+            readRejectionMatrices(xmlConfig, radioFamily, thresholds);
+            it = captureThresholdCache.emplace(key, thresholds).first;
+        }
+        captureThresholds = &it->second;
     }
 }
 
+void LoRaReceiver::readRejectionMatrices(cXMLElement *xmlConfig, const char *radioFamily, CaptureThresholds& thresholds)
+{
+    bool defined[numBandwidths] = {false, false, false};
+    cXMLElementList matrixList = xmlConfig != nullptr ? xmlConfig->getElementsByTagName("matrix") : cXMLElementList();
+    for (auto matrix : matrixList) {
+        const char *radio = matrix->getAttribute("radio");
+        const char *bandwidth = matrix->getAttribute("bandwidth");
+        if (radio == nullptr || bandwidth == nullptr)
+            throw cRuntimeError("Rejection matrix at %s needs a radio and a bandwidth attribute", matrix->getSourceLocation());
+        if (strcmp(radio, radioFamily))
+            continue;
+        int bwIndex = getBandwidthIndex(Hz(strtod(bandwidth, nullptr)));
+        cXMLElementList rowList = matrix->getChildrenByTagName("row");
+        if (rowList.size() != numSF)
+            throw cRuntimeError("Rejection matrix at %s must have %d rows", matrix->getSourceLocation(), numSF);
+        for (auto row : rowList) {
+            const char *sf = row->getAttribute("sf");
+            int sfIndex = sf != nullptr ? atoi(sf) - 7 : -1;
+            if (sfIndex < 0 || sfIndex >= numSF)
+                throw cRuntimeError("Invalid sf attribute in rejection matrix row at %s", row->getSourceLocation());
+            std::vector<double> deltas = cStringTokenizer(row->getNodeValue()).asDoubleVector();
+            if (deltas.size() != numSF)
+                throw cRuntimeError("Rejection matrix row at %s must have %d values", row->getSourceLocation(), numSF);
+            for (int i = 0; i < numSF; i++)
+                thresholds.ratio[bwIndex][sfIndex][i] = math::dB2fraction(deltas[i]);
+        }
+        defined[bwIndex] = true;
+    }
+    if (std::none_of(defined, defined + numBandwidths, [] (bool d) { return d; })) {
+        // without an XML matrix only the built-in SX127x thresholds are known
+        if (strcmp(radioFamily, "sx127x"))
+            throw cRuntimeError("No rejection matrix for radio family '%s'", radioFamily);
+        for (int bwIndex = 0; bwIndex < numBandwidths; bwIndex++)
+            for (int i = 0; i < numSF; i++)
+                for (int j = 0; j < numSF; j++)
+                    thresholds.ratio[bwIndex][i][j] = math::dB2fraction(defaultNonOrthDelta[i][j]);
+        return;
+    }
+    static const char *bandwidths[numBandwidths] = {"125000", "250000", "500000"};
+    for (int bwIndex = 0; bwIndex < numBandwidths; bwIndex++)
+        if (!defined[bwIndex])
+            throw cRuntimeError("No rejection matrix for radio family '%s' with bandwidth %s", radioFamily, bandwidths[bwIndex]);
+}
+
+int LoRaReceiver::getBandwidthIndex(Hz bandwidth)
+{
+    if (bandwidth == Hz(125000))
+        return 0;
+    else if (bandwidth == Hz(250000))
+        return 1;
+    else if (bandwidth == Hz(500000))
+        return 2;
+    else
+        throw cRuntimeError("Unsupported LoRa bandwidth %g Hz", bandwidth.get());
+}
+
 void LoRaReceiver::finish()
 {
         recordScalar("numCollisions", numCollisions);
@@ -109,7 +191,7 @@ bool LoRaReceiver::computeIsReceptionAttempted(const IListening *listening, cons
             //EV << "Node: Extracted macFrame = " << loraMacFrame->getReceiverAddress() << ", node address = " << macLayer->getAddress() << std::endl;
         } else {
             auto *gwMacLayer = check_and_cast<LoRaGWMac *>(getParentModule()->getParentModule()->getSubmodule("mac"));
-            EV << "GW: Extracted macFrame = " << rec << ", node address = " << gwMacLayer->getAddress() << std::endl;
+            EV_DEBUG << "GW: Extracted macFrame = " << rec << ", node address = " << gwMacLayer->getAddress() << std::endl;
             if (rec == MacAddress::BROADCAST_ADDRESS) {
                 const_cast<LoRaReceiver* >(this)->numCollisions++;
             }
@@ -128,14 +210,10 @@ bool LoRaReceiver::isPacketCollided(const IReception *reception, IRadioSignal::S
     const LoRaReception *loRaReception = check_and_cast<const LoRaReception *>(reception);
     simtime_t m_x = (loRaReception->getStartTime() + loRaReception->getEndTime())/2;
     simtime_t d_x = (loRaReception->getEndTime() - loRaReception->getStartTime())/2;
-    EV << "Czas transmisji to " << loRaReception->getEndTime() - loRaReception->getStartTime() << endl;
-    double P_threshold = 6;
-    W signalRSSI_w = loRaReception->getPower();
-    double signalRSSI_mw = signalRSSI_w.get()*1000;
-    double signalRSSI_dBm = math::mW2dBmW(signalRSSI_mw);
-    EV << signalRSSI_mw << endl;
-    EV << signalRSSI_dBm << endl;
+    EV_TRACE << "Czas transmisji to " << loRaReception->getEndTime() - loRaReception->getStartTime() << endl;
+    double signalRSSI_w = loRaReception->getPower().get();
     int receptionSF = loRaReception->getLoRaSF();
+    const double *captureThreshold = captureThresholds->ratio[getBandwidthIndex(loRaReception->getLoRaBW())][receptionSF - 7];
     for (auto interferingReception : *interferingReceptions) {
         bool overlap = false;
         bool frequencyCollision = false;
@@ -155,26 +233,24 @@ bool LoRaReceiver::isPacketCollided(const IReception *reception, IRadioSignal::S
             frequencyCollision = true;
         }
 
-        W interferenceRSSI_w = loRaInterference->getPower();
-        double interferenceRSSI_mw = interferenceRSSI_w.get()*1000;
-        double interferenceRSSI_dBm = math::mW2dBmW(interferenceRSSI_mw);
+        double interferenceRSSI_w = loRaInterference->getPower().get();
         int interferenceSF = loRaInterference->getLoRaSF();
 
-        /* If difference in power between two signals is greater than threshold, no collision*/
-        if(signalRSSI_dBm - interferenceRSSI_dBm >= nonOrthDelta[receptionSF-7][interferenceSF-7])
+        /* If the power ratio between two signals is above the rejection threshold, no collision*/
+        if(signalRSSI_w >= interferenceRSSI_w * captureThreshold[interferenceSF - 7])
         {
             captureEffect = true;
         }
 
-        EV << "[MSDEBUG] Received packet at SF: " << receptionSF << " with power " << signalRSSI_dBm << endl;
-        EV << "[MSDEBUG] Received interference at SF: " << interferenceSF << " with power " << interferenceRSSI_dBm << endl;
-        EV << "[MSDEBUG] Acceptable diff is equal " << nonOrthDelta[receptionSF-7][interferenceSF-7] << endl;
-        EV << "[MSDEBUG] Diff is equal " << signalRSSI_dBm - interferenceRSSI_dBm << endl;
+        EV_DEBUG << "[MSDEBUG] Received packet at SF: " << receptionSF << " with power " << math::mW2dBmW(signalRSSI_w * 1000) << endl;
+        EV_DEBUG << "[MSDEBUG] Received interference at SF: " << interferenceSF << " with power " << math::mW2dBmW(interferenceRSSI_w * 1000) << endl;
+        EV_DEBUG << "[MSDEBUG] Acceptable diff is equal " << math::fraction2dB(captureThreshold[interferenceSF - 7]) << endl;
+        EV_DEBUG << "[MSDEBUG] Diff is equal " << math::fraction2dB(signalRSSI_w / interferenceRSSI_w) << endl;
         if (captureEffect == false)
         {
-            EV << "[MSDEBUG] Packet is discarded" << endl;
+            EV_DEBUG << "[MSDEBUG] Packet is discarded" << endl;
         } else
-            EV << "[MSDEBUG] Packet is not discarded" << endl;
+            EV_DEBUG << "[MSDEBUG] Packet is not discarded" << endl;
 
         /* If last 6 symbols of preamble are received, no collision*/
         double nPreamble = 8; //from the paper "Do Lora networks..."
@@ -243,12 +319,17 @@ const IReceptionResult *LoRaReceiver::computeReceptionResult(const IListening *l
     auto signalTimeInd = packet->addTagIfAbsent<SignalTimeInd>();
     signalTimeInd->setStartTime(reception->getStartTime());
     signalTimeInd->setEndTime(reception->getEndTime());
+    // the ErrorRateInd is added lazily by addErrorRateInd() once the frame is actually sent up
+
+    return new ReceptionResult(reception, decisions, packet);
+}
+
+void LoRaReceiver::addErrorRateInd(Packet *packet, const ISnir *snir) const
+{
     auto errorRateInd = packet->addTagIfAbsent<ErrorRateInd>();
     errorRateInd->setPacketErrorRate(errorModel ? errorModel->computePacketErrorRate(snir, IRadioSignal::SIGNAL_PART_WHOLE) : 0.0);
     errorRateInd->setBitErrorRate(errorModel ? errorModel->computeBitErrorRate(snir, IRadioSignal::SIGNAL_PART_WHOLE) : 0.0);
     errorRateInd->setSymbolErrorRate(errorModel ? errorModel->computeSymbolErrorRate(snir, IRadioSignal::SIGNAL_PART_WHOLE) : 0.0);
-
-    return new ReceptionResult(reception, decisions, packet);
 }
 
 bool LoRaReceiver::computeIsReceptionSuccessful(const IListening *listening, const IReception *reception, IRadioSignal::SignalPart part, const IInterference *interference, const ISnir *snir) const
@@ -286,53 +367,58 @@ const IListeningDecision *LoRaReceiver::computeListeningDecision(const IListenin
 }
 
 W LoRaReceiver::getSensitivity(const LoRaReception *reception) const
+{
+    return getSensitivity(reception->getLoRaSF(), reception->getLoRaBW());
+}
+
+W LoRaReceiver::getSensitivity(int spreadFactor, Hz bandwidth)
 {
     //function returns sensitivity -- according to LoRa documentation, it changes with LoRa parameters
     //Sensitivity values from Semtech SX1272/73 datasheet, table 10, Rev 3.1, March 2017
     W sensitivity = W(math::dBmW2mW(-126.5) / 1000);
-    if(reception->getLoRaSF() == 6)
+    if(spreadFactor == 6)
     {
-        if(reception->getLoRaBW() == Hz(125000)) sensitivity = W(math::dBmW2mW(-121) / 1000);
-        if(reception->getLoRaBW() == Hz(250000)) sensitivity = W(math::dBmW2mW(-118) / 1000);
-        if(reception->getLoRaBW() == Hz(500000)) sensitivity = W(math::dBmW2mW(-111) / 1000);
+        if(bandwidth == Hz(125000)) sensitivity = W(math::dBmW2mW(-121) / 1000);
+        if(bandwidth == Hz(250000)) sensitivity = W(math::dBmW2mW(-118) / 1000);
+        if(bandwidth == Hz(500000)) sensitivity = W(math::dBmW2mW(-111) / 1000);
     }
 
-    if (reception->getLoRaSF() == 7)
+    if (spreadFactor == 7)
     {
-        if(reception->getLoRaBW() == Hz(125000)) sensitivity = W(math::dBmW2mW(-124) / 1000);
-        if(reception->getLoRaBW() == Hz(250000)) sensitivity = W(math::dBmW2mW(-122) / 1000);
-        if(reception->getLoRaBW() == Hz(500000)) sensitivity = W(math::dBmW2mW(-116) / 1000);
+        if(bandwidth == Hz(125000)) sensitivity = W(math::dBmW2mW(-124) / 1000);
+        if(bandwidth == Hz(250000)) sensitivity = W(math::dBmW2mW(-122) / 1000);
+        if(bandwidth == Hz(500000)) sensitivity = W(math::dBmW2mW(-116) / 1000);
     }
 
-    if(reception->getLoRaSF() == 8)
+    if(spreadFactor == 8)
     {
-        if(reception->getLoRaBW() == Hz(125000)) sensitivity = W(math::dBmW2mW(-127) / 1000);
-        if(reception->getLoRaBW() == Hz(250000)) sensitivity = W(math::dBmW2mW(-125) / 1000);
-        if(reception->getLoRaBW() == Hz(500000)) sensitivity = W(math::dBmW2mW(-119) / 1000);
+        if(bandwidth == Hz(125000)) sensitivity = W(math::dBmW2mW(-127) / 1000);
+        if(bandwidth == Hz(250000)) sensitivity = W(math::dBmW2mW(-125) / 1000);
+        if(bandwidth == Hz(500000)) sensitivity = W(math::dBmW2mW(-119) / 1000);
     }
-    if(reception->getLoRaSF() == 9)
+    if(spreadFactor == 9)
     {
-        if(reception->getLoRaBW() == Hz(125000)) sensitivity = W(math::dBmW2mW(-130) / 1000);
-        if(reception->getLoRaBW() == Hz(250000)) sensitivity = W(math::dBmW2mW(-128) / 1000);
-        if(reception->getLoRaBW() == Hz(500000)) sensitivity = W(math::dBmW2mW(-122) / 1000);
+        if(bandwidth == Hz(125000)) sensitivity = W(math::dBmW2mW(-130) / 1000);
+        if(bandwidth == Hz(250000)) sensitivity = W(math::dBmW2mW(-128) / 1000);
+        if(bandwidth == Hz(500000)) sensitivity = W(math::dBmW2mW(-122) / 1000);
     }
-    if(reception->getLoRaSF() == 10)
+    if(spreadFactor == 10)
     {
-        if(reception->getLoRaBW() == Hz(125000)) sensitivity = W(math::dBmW2mW(-133) / 1000);
-        if(reception->getLoRaBW() == Hz(250000)) sensitivity = W(math::dBmW2mW(-130) / 1000);
-        if(reception->getLoRaBW() == Hz(500000)) sensitivity = W(math::dBmW2mW(-125) / 1000);
+        if(bandwidth == Hz(125000)) sensitivity = W(math::dBmW2mW(-133) / 1000);
+        if(bandwidth == Hz(250000)) sensitivity = W(math::dBmW2mW(-130) / 1000);
+        if(bandwidth == Hz(500000)) sensitivity = W(math::dBmW2mW(-125) / 1000);
     }
-    if(reception->getLoRaSF() == 11)
+    if(spreadFactor == 11)
     {
-        if(reception->getLoRaBW() == Hz(125000)) sensitivity = W(math::dBmW2mW(-135) / 1000);
-        if(reception->getLoRaBW() == Hz(250000)) sensitivity = W(math::dBmW2mW(-132) / 1000);
-        if(reception->getLoRaBW() == Hz(500000)) sensitivity = W(math::dBmW2mW(-128) / 1000);
+        if(bandwidth == Hz(125000)) sensitivity = W(math::dBmW2mW(-135) / 1000);
+        if(bandwidth == Hz(250000)) sensitivity = W(math::dBmW2mW(-132) / 1000);
+        if(bandwidth == Hz(500000)) sensitivity = W(math::dBmW2mW(-128) / 1000);
     }
-    if(reception->getLoRaSF() == 12)
+    if(spreadFactor == 12)
     {
-        if(reception->getLoRaBW() == Hz(125000)) sensitivity = W(math::dBmW2mW(-137) / 1000);
-        if(reception->getLoRaBW() == Hz(250000)) sensitivity = W(math::dBmW2mW(-135) / 1000);
-        if(reception->getLoRaBW() == Hz(500000)) sensitivity = W(math::dBmW2mW(-129) / 1000);
+        if(bandwidth == Hz(125000)) sensitivity = W(math::dBmW2mW(-137) / 1000);
+        if(bandwidth == Hz(250000)) sensitivity = W(math::dBmW2mW(-135) / 1000);
+        if(bandwidth == Hz(500000)) sensitivity = W(math::dBmW2mW(-129) / 1000);
     }
     return sensitivity;
 }
@@ -57,14 +57,24 @@ private:
 
     simsignal_t LoRaReceptionCollision;
 
-    int nonOrthDelta[6][6] = {
-       {1, -8, -9, -9, -9, -9},
-       {-11, 1, -11, -12, -13, -13},
-       {-15, -13, 1, -13, -14, -15},
-       {-19, -18, -17, 1, -17, -18},
-       {-22, -22, -21, -20, 1, -20},
-       {-25, -25, -25, -24, -23, 1}
+    static const int numBandwidths = 3;    // 125, 250 and 500 kHz
+    static const int numSF = 6;    // SF7 - SF12
+
+    /**
+     * Minimum power ratio (linear) of the wanted signal over an interferer,
+     * indexed by bandwidth, wanted SF and interfering SF, for the configured
+     * radio family.
+     */
+    struct CaptureThresholds {
+        double ratio[numBandwidths][numSF][numSF];
     };
+    const CaptureThresholds *captureThresholds = nullptr;
+    /**
+     * Tables parsed from the rejectionMatrices XML, shared by all receivers
+     * with the same XML element and radio family. XML documents stay cached
+     * by the environment for the whole process, so the keys stay valid.
+     */
+    static std::map<std::pair<const cXMLElement *, std::string>, CaptureThresholds> captureThresholdCache;
 
     //statistics
     long numCollisions;
@@ -88,6 +98,12 @@ public:
   virtual const IReceptionDecision *computeReceptionDecision(const IListening *listening, const IReception *reception, IRadioSignal::SignalPart part, const IInterference *interference, const ISnir *snir) const override;
   virtual const IReceptionResult *computeReceptionResult(const IListening *listening, const IReception *reception, const IInterference *interference, const ISnir *snir, const std::vector<const IReceptionDecision *> *decisions) const override;
 
+  /**
+   * Fills in the error rates of a received frame. Called by the radio only
+   * for frames that are sent up to the MAC.
+   */
+  virtual void addErrorRateInd(Packet *packet, const ISnir *snir) const;
+
   virtual bool computeIsReceptionSuccessful(const IListening *listening, const IReception *reception, IRadioSignal::SignalPart part, const IInterference *interference, const ISnir *snir) const override;
 
   virtual double getSNIRThreshold() const override { return snirThreshold; }
@@ -96,6 +112,10 @@ public:
   virtual const IListeningDecision *computeListeningDecision(const IListening *listening, const IInterference *interference) const override;
 
   W getSensitivity(const LoRaReception *loRaReception) const;
+  static W getSensitivity(int spreadFactor, Hz bandwidth);
+
+  static void readRejectionMatrices(cXMLElement *xmlConfig, const char *radioFamily, CaptureThresholds& thresholds);
+  static int getBandwidthIndex(Hz bandwidth);
 
   bool isPacketCollided(const IReception *reception, IRadioSignal::SignalPart part, const IInterference *interference) const;
 
@@ -60,7 +60,7 @@ const ITransmission *LoRaTransmitter::createTransmission(const IRadio *transmitt
     //W transmissionPower = controlInfo && !std::isnan(controlInfo->getPower().get()) ? controlInfo->getPower() : power;
     const_cast<LoRaTransmitter* >(this)->emit(LoRaTransmissionCreated, true);
 //    const LoRaMacFrame *frame = check_and_cast<const LoRaMacFrame *>(macFrame);
-    EV << macFrame->getDetailStringRepresentation(evFlags) << endl;
+    EV_DEBUG << macFrame->getDetailStringRepresentation(evFlags) << endl;
     const auto &frame = macFrame->peekAtFront<LoRaPhyPreamble>();
 
     int nPreamble = 8;
@@ -93,8 +93,8 @@ const ITransmission *LoRaTransmitter::createTransmission(const IRadio *transmitt
     else
         transmissionPower = mW(math::dBmW2mW(14));
 
-    EV << "[MSDebug] I am sending packet with TP: " << transmissionPower << endl;
-    EV << "[MSDebug] I am sending packet with SF: " << frame->getSpreadFactor() << endl;
+    EV_DEBUG << "[MSDebug] I am sending packet with TP: " << transmissionPower << endl;
+    EV_DEBUG << "[MSDebug] I am sending packet with SF: " << frame->getSpreadFactor() << endl;
 
 
     return new LoRaTransmission(transmitter,